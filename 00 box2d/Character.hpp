@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#include <Box2D/Box2D.h>
+
+#include "Platformer.hpp"
+#include "ThreadPool.hpp"
+
+// Characters: the player and any number of bots, all driven by one
+// Characters object that is also the world's contact listener.
+//
+//   Characters characters;
+//   world.SetContactListener(&characters);
+//   int i = characters.add(playerRecipe(characters.tuning).build(world));
+//   ...
+//   platformerStep(world, characters, inputs, dt, width, onWrap); // one input per character
+//
+// Every character gets a foot sensor: a circle around its body, a little
+// larger than the body however it is turned. The listener only counts the
+// solid fixtures each foot overlaps and notes the exit; it never touches
+// the world. After every step, sense() casts a few rays per character, for
+// the ground below and the walls on either side, and keeps the results in
+// the Character until the next step. react() then applies the wall kicks
+// and resets jumps from those, outside the step. Rays are read-only, so
+// ranges of characters can be sensed on different threads.
+//
+// Every fixture of a character carries its index next to its Kind in
+// userData (see characterOf), so the listener finds the character with a
+// shift, whatever the crowd's size.
+
+// What the player asked for in one step. The game samples it before every
+// step, so it is also what a replay records and plays back.
+struct StepInput
+{
+  enum : uint8_t { Left = 1, Right = 2, Jump = 4, PadA = 8 };
+  uint8_t held;   // buttons down at this step, or pressed since the last one
+  int8_t jx, jy;  // joystick axes, -100..100
+  uint8_t reserved;
+};
+
+inline int characterOf(b2Fixture* f) { return int(f->GetUserData().pointer >> 8) - 1; }
+
+inline void tagCharacter(b2Body* body, int index) {
+  for (b2Fixture* f = body->GetFixtureList(); f; f = f->GetNext()) {
+    uintptr_t& p = f->GetUserData().pointer;
+    p = (p & 0xFF) | uintptr_t(index + 1) << 8;
+  }
+}
+
+struct Character
+{
+  b2Body* body = nullptr;
+  b2Fixture* hull = nullptr;   // the body's solid fixture
+  b2Fixture* foot = nullptr;   // sensor around it
+  int jumpCount = 0;
+  uint8_t lastHeld = 0;        // StepInput::held of the previous step
+  int footContacts = 0;        // solid fixtures the foot overlaps, kept by the listener
+  b2Body* reachedExit = nullptr; // the exit's body, once touched; the owner resets it
+
+  // As of the end of the last step, from sense().
+  bool grounded = false;
+  float groundGap = FLT_MAX;   // m from the hull's bottom to what's below, FLT_MAX if out of reach
+  Kind left = Kind::Count;     // what the hull touches on either side, Count for nothing
+  Kind right = Kind::Count;
+  bool onLeftWall = false, onRightWall = false; // as of the last react(), for kicking once per touch
+};
+
+class Characters : public b2ContactListener
+{
+  std::vector<Character> list;
+
+  // The nearest fixture along a ray that a character would collide with,
+  // other than the character's own.
+  struct SolidRay : public b2RayCastCallback
+  {
+    b2Body* self;
+    b2Fixture* hit = nullptr;
+    float fraction = 1;
+
+    explicit SolidRay(b2Body* self) : self(self) {}
+
+    float ReportFixture(b2Fixture* f, const b2Vec2&, const b2Vec2&, float fr) override {
+      if (f->IsSensor() || f->GetBody() == self || !(f->GetFilterData().maskBits & categoryOf(Kind::Player)))
+        return -1;
+      hit = f;
+      fraction = fr;
+      return fr;
+    }
+  };
+
+  // Gap between the hull and the nearest solid thing from `from` along
+  // dir, for a ray that starts extent inside the hull.
+  static float gap(b2World& world, b2Body* self, b2Vec2 from, b2Vec2 dir, float extent, float probe, Kind* kind) {
+    SolidRay ray(self);
+    world.RayCast(&ray, from, from + (extent + probe) * dir);
+    if (kind) *kind = ray.hit ? kindOf(ray.hit) : Kind::Count;
+    return ray.hit ? ray.fraction * (extent + probe) - extent : FLT_MAX;
+  }
+
+  void touch(b2Fixture* self, b2Fixture* other, int delta) {
+    int i = characterOf(self);
+    if (i < 0 || i >= int(list.size()) || other->IsSensor()) return;
+    Character& c = list[size_t(i)];
+    if (self == c.foot) c.footContacts += delta;
+    else if (delta > 0 && kindOf(other) == Kind::Exit) c.reachedExit = other->GetBody();
+  }
+
+  void count(b2Contact* contact, int delta) {
+    b2Fixture* a = contact->GetFixtureA();
+    b2Fixture* b = contact->GetFixtureB();
+    uint16 categories = a->GetFilterData().categoryBits | b->GetFilterData().categoryBits;
+    if (!(categories & categoryOf(Kind::Player))) return; // box on box, box on scenery
+    touch(a, b, delta);
+    touch(b, a, delta);
+  }
+
+public:
+  Tuning tuning;
+  float skin = 0.05f;  // m; closer than this counts as touching
+  float probe = 0.5f;  // m; how far below the hull groundGap is measured
+
+  int size() const { return int(list.size()); }
+  Character& operator[](int i) { return list[size_t(i)]; }
+  const Character& operator[](int i) const { return list[size_t(i)]; }
+
+  // Makes a character of a body with one solid fixture, and returns its
+  // index. Adds the foot sensor, which has no mass.
+  int add(b2Body* body) {
+    Character c;
+    c.body = body;
+    c.hull = body->GetFixtureList();
+    b2Transform identity;
+    identity.SetIdentity();
+    b2AABB box;
+    c.hull->GetShape()->ComputeAABB(&box, identity, 0);
+    b2Vec2 half = 0.5f * (box.upperBound - box.lowerBound);
+
+    b2CircleShape around;
+    around.m_radius = half.Length() + skin;
+    b2FixtureDef def;
+    def.shape = &around;
+    def.isSensor = true;
+    setKind(def, Kind::Player);
+    c.foot = body->CreateFixture(&def);
+
+    list.push_back(c);
+    tagCharacter(body, int(list.size()) - 1);
+    return int(list.size()) - 1;
+  }
+
+  // Forgets a character; the last one takes its index. The body stays in
+  // the world, untagged, for the caller to destroy.
+  void remove(int i) {
+    Character& c = list[size_t(i)];
+    c.body->DestroyFixture(c.foot);
+    tagCharacter(c.body, -1);
+    if (i != int(list.size()) - 1) {
+      c = list.back();
+      tagCharacter(c.body, i);
+    }
+    list.pop_back();
+  }
+
+  // Before the world the bodies are in goes away.
+  void clear() { list.clear(); }
+
+  void moveRight(Character& c) const {
+    b2Vec2 vel = c.body->GetLinearVelocity(); vel.x = tuning.runSpeed;
+    c.body->SetLinearVelocity(vel);
+    c.body->SetAngularVelocity(tuning.spin * b2_pi / 180);
+  }
+
+  void moveLeft(Character& c) const {
+    b2Vec2 vel = c.body->GetLinearVelocity(); vel.x = -tuning.runSpeed;
+    c.body->SetLinearVelocity(vel);
+    c.body->SetAngularVelocity(-tuning.spin * b2_pi / 180);
+  }
+
+  // Returns false when out of jumps.
+  bool jump(Character& c) const {
+    if (c.jumpCount >= tuning.maxJumps) return false;
+    b2Vec2 vel = c.body->GetLinearVelocity(); vel.y = -tuning.jumpSpeed;
+    c.body->SetLinearVelocity(vel);
+    c.jumpCount++;
+    return true;
+  }
+
+  // Runs, and jumps on a press of either jump button.
+  void apply(Character& c, const StepInput& in) const {
+    uint8_t pressed = in.held & ~c.lastHeld;
+    c.lastHeld = in.held;
+    if (in.held & StepInput::Left) moveLeft(c);
+    if (in.held & StepInput::Right) moveRight(c);
+    if (in.jx > 40) moveRight(c);
+    if (in.jx < -40) moveLeft(c);
+    if (pressed & (StepInput::Jump | StepInput::PadA)) jump(c);
+  }
+
+  void BeginContact(b2Contact* contact) override { count(contact, 1); }
+  void EndContact(b2Contact* contact) override { count(contact, -1); }
+
+  // Refreshes the cached queries of characters [begin, end). Two rays go
+  // down from near the hull's bottom corners, one to each side from its
+  // center. Call after Step, with nothing changing the world meanwhile.
+  void sense(b2World& world, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      Character& c = list[size_t(i)];
+      b2AABB box;
+      c.hull->GetShape()->ComputeAABB(&box, c.body->GetTransform(), 0);
+      b2Vec2 center = box.GetCenter();
+      b2Vec2 half = 0.5f * (box.upperBound - box.lowerBound);
+
+      float inset = 0.8f * half.x;
+      c.groundGap = std::min(
+        gap(world, c.body, b2Vec2(center.x - inset, center.y), b2Vec2(0, 1), half.y, probe, nullptr),
+        gap(world, c.body, b2Vec2(center.x + inset, center.y), b2Vec2(0, 1), half.y, probe, nullptr));
+      c.grounded = c.footContacts > 0 && c.groundGap <= skin;
+
+      Kind left, right;
+      float leftGap = gap(world, c.body, center, b2Vec2(-1, 0), half.x, skin, &left);
+      float rightGap = gap(world, c.body, center, b2Vec2(1, 0), half.x, skin, &right);
+      c.left = leftGap <= skin ? left : Kind::Count;
+      c.right = rightGap <= skin ? right : Kind::Count;
+    }
+  }
+
+  void afterStep(b2World& world) {
+    sense(world, 0, size());
+    react();
+  }
+
+  // Kicks characters off walls they have just touched and gives back the
+  // jumps of those that stand on something. After sense().
+  void react() {
+    for (Character& c : list) {
+      float impulse = c.body->GetMass();
+      bool onLeftWall = c.left == Kind::LeftWall, onRightWall = c.right == Kind::RightWall;
+      if (onLeftWall && !c.onLeftWall) {
+        c.body->ApplyLinearImpulse(b2Vec2(tuning.wallKick * impulse, 0), c.body->GetWorldCenter(), true);
+        moveRight(c);
+        c.body->ApplyLinearImpulse(b2Vec2(0, -impulse * tuning.wallLift), c.body->GetWorldCenter(), true);
+      }
+      if (onRightWall && !c.onRightWall) {
+        c.body->ApplyLinearImpulse(b2Vec2(-2 * tuning.wallKick * impulse, -impulse * tuning.wallLift),
+          c.body->GetWorldCenter(), true);
+      }
+      c.onLeftWall = onLeftWall;
+      c.onRightWall = onRightWall;
+      if (c.grounded && c.body->GetLinearVelocity().y >= 0)
+        c.jumpCount = 0;
+    }
+  }
+};
+
+// One fixed step of the game: every character's input, the world step,
+// the characters' reactions and wrapping awake bodies around the side
+// edges of a screen width px wide. onWrap(body) sees every body moved that
+// way. With a pool, crowds are sensed in chunks on it; the results are the
+// same either way. The game and the replay tool both step through here, in
+// the same order, so that a recorded session plays back bit for bit.
+template <typename OnWrap>
+void platformerStep(b2World& world, Characters& characters, const StepInput* inputs, float dt, float width,
+                    OnWrap onWrap, ThreadPool* pool = nullptr)
+{
+  const int chunk = 64;
+  int n = characters.size();
+  for (int i = 0; i < n; i++) characters.apply(characters[i], inputs[i]);
+  world.Step(dt, characters.tuning.velocityIterations, characters.tuning.positionIterations);
+  if (pool && n > chunk) {
+    pool->parallelFor((n + chunk - 1) / chunk, [&](int k) {
+      characters.sense(world, k * chunk, std::min(n, (k + 1) * chunk));
+    });
+    characters.react();
+  } else {
+    characters.afterStep(world);
+  }
+  for (b2Body* b = world.GetBodyList(); b; b = b->GetNext()) {
+    if (b->GetType() != b2_dynamicBody || !b->IsEnabled() || !b->IsAwake()) continue;
+    b2Vec2 pos = b->GetPosition();
+    float x = pos.x >= width / PPM ? 0.0f : pos.x < 0 ? width / PPM : pos.x;
+    if (x == pos.x) continue;
+    b->SetTransform(b2Vec2(x, pos.y), b->GetAngle());
+    onWrap(b);
+  }
+}
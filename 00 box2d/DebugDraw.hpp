@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cmath>
+
+#include <Box2D/Box2D.h>
+#include <SFML/Graphics.hpp>
+
+#include "Profiler.hpp"
+
+// b2Draw that batches everything Box2D reports into three vertex arrays,
+// so a whole-world debug view costs three draw calls however many bodies
+// there are.
+//
+//   DebugDraw debugDraw(PPM);
+//   world.SetDebugDraw(&debugDraw);
+//   ...
+//   debugDraw.begin();
+//   world.DebugDraw();          // with the world locked against stepping
+//   debugDraw.contactPoints(world);
+//   debugDraw.draw(window);     // the world may step again meanwhile
+//
+// Which parts are drawn is set with SetFlags() (the b2Draw::e_*Bit flags);
+// contact points aren't one of them, so they are drawn on request.
+// World::DebugDraw colors shapes by state: static, kinematic, asleep, awake.
+class DebugDraw : public b2Draw
+{
+  sf::VertexArray fills{sf::Triangles};
+  sf::VertexArray lines{sf::Lines};
+  sf::VertexArray points{sf::Quads};
+  float scale;
+
+  static const int circleSegments = 16;
+
+  sf::Vector2f toScreen(const b2Vec2& v) const { return sf::Vector2f(v.x * scale, v.y * scale); }
+
+  static sf::Color toColor(const b2Color& c, float alpha = 1.0f) {
+    return sf::Color(sf::Uint8(c.r * 255), sf::Uint8(c.g * 255), sf::Uint8(c.b * 255),
+      sf::Uint8(c.a * alpha * 255));
+  }
+
+  void line(const b2Vec2& a, const b2Vec2& b, sf::Color color) {
+    lines.append(sf::Vertex(toScreen(a), color));
+    lines.append(sf::Vertex(toScreen(b), color));
+  }
+
+  void circlePoints(const b2Vec2& center, float radius, b2Vec2* out) const {
+    for (int i = 0; i < circleSegments; i++) {
+      float a = i * 2 * b2_pi / circleSegments;
+      out[i] = b2Vec2(center.x + radius * std::cos(a), center.y + radius * std::sin(a));
+    }
+  }
+
+public:
+  explicit DebugDraw(float pixelsPerMeter) : scale(pixelsPerMeter) {
+    SetFlags(e_shapeBit);
+  }
+
+  int vertexCount() const { return int(fills.getVertexCount() + lines.getVertexCount() + points.getVertexCount()); }
+
+  void begin() {
+    fills.clear();
+    lines.clear();
+    points.clear();
+  }
+
+  void draw(sf::RenderTarget& target) {
+    PROFILE_ZONE("debug draw");
+    target.draw(fills);
+    target.draw(lines);
+    target.draw(points);
+  }
+
+  // Marks every touching manifold point in the world.
+  void contactPoints(b2World& world) {
+    for (b2Contact* c = world.GetContactList(); c; c = c->GetNext()) {
+      int n = c->GetManifold()->pointCount;
+      if (n == 0 || !c->IsTouching()) continue;
+      b2WorldManifold m;
+      c->GetWorldManifold(&m);
+      for (int i = 0; i < n; i++) {
+        DrawPoint(m.points[i], 4.0f, b2Color(1, 0.9f, 0.2f));
+        DrawSegment(m.points[i], m.points[i] + 0.3f * m.normal, b2Color(1, 0.9f, 0.2f));
+      }
+    }
+  }
+
+  void DrawPolygon(const b2Vec2* vertices, int32 count, const b2Color& color) override {
+    sf::Color c = toColor(color);
+    for (int32 i = 0; i < count; i++) line(vertices[i], vertices[(i + 1) % count], c);
+  }
+
+  void DrawSolidPolygon(const b2Vec2* vertices, int32 count, const b2Color& color) override {
+    sf::Color fill = toColor(color, 0.5f);
+    for (int32 i = 1; i + 1 < count; i++) {
+      fills.append(sf::Vertex(toScreen(vertices[0]), fill));
+      fills.append(sf::Vertex(toScreen(vertices[i]), fill));
+      fills.append(sf::Vertex(toScreen(vertices[i + 1]), fill));
+    }
+    DrawPolygon(vertices, count, color);
+  }
+
+  void DrawCircle(const b2Vec2& center, float radius, const b2Color& color) override {
+    b2Vec2 v[circleSegments];
+    circlePoints(center, radius, v);
+    DrawPolygon(v, circleSegments, color);
+  }
+
+  void DrawSolidCircle(const b2Vec2& center, float radius, const b2Vec2& axis, const b2Color& color) override {
+    b2Vec2 v[circleSegments];
+    circlePoints(center, radius, v);
+    DrawSolidPolygon(v, circleSegments, color);
+    line(center, center + radius * axis, toColor(color));
+  }
+
+  void DrawSegment(const b2Vec2& p1, const b2Vec2& p2, const b2Color& color) override {
+    line(p1, p2, toColor(color));
+  }
+
+  void DrawTransform(const b2Transform& xf) override {
+    const float axisScale = 0.4f;
+    line(xf.p, xf.p + axisScale * xf.q.GetXAxis(), sf::Color::Red);
+    line(xf.p, xf.p + axisScale * xf.q.GetYAxis(), sf::Color::Green);
+  }
+
+  // size is in pixels.
+  void DrawPoint(const b2Vec2& p, float size, const b2Color& color) override {
+    sf::Vector2f c = toScreen(p);
+    float h = size * 0.5f;
+    sf::Color col = toColor(color);
+    points.append(sf::Vertex(sf::Vector2f(c.x - h, c.y - h), col));
+    points.append(sf::Vertex(sf::Vector2f(c.x + h, c.y - h), col));
+    points.append(sf::Vertex(sf::Vector2f(c.x + h, c.y + h), col));
+    points.append(sf::Vertex(sf::Vector2f(c.x - h, c.y + h), col));
+  }
+};
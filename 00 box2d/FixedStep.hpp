@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Fixed-timestep driver. Frame time goes into an accumulator and comes out
+// as whole physics steps of dt, so simulated time follows the wall clock
+// whatever the frame rate, and the physics cost per second stays the same.
+//
+//   int n = stepper.advance(frameClock.restart().asSeconds());
+//   for (int i = 0; i < n; i++) world.Step(stepper.dt, 6, 2);
+//   render at stepper.alpha() between the previous and the current step
+//
+// A slow frame can ask for at most maxSubsteps steps; the time beyond that
+// is dropped rather than carried over (the spiral of death). While paused,
+// only singleStep() requests advance the simulation, one step each.
+class FixedStep
+{
+public:
+  float dt = 1.0f / 120;
+  int maxSubsteps = 8;
+  float timeScale = 1.0f;
+  bool paused = false;
+
+  float accumulator = 0;
+  int lastSteps = 0;       // steps taken by the last advance()
+  uint64_t steps = 0;      // since start
+  float droppedTime = 0;   // seconds discarded by the substep clamp
+
+  int advance(float frameTime) {
+    int n;
+    if (paused) {
+      n = pendingSingle;
+      pendingSingle = 0;
+      accumulator = 0;
+    } else {
+      // A debugger break or window drag shouldn't turn into seconds of catch-up.
+      accumulator += std::min(frameTime, 0.25f) * timeScale;
+      n = int(accumulator / dt);
+      if (n > maxSubsteps) {
+        droppedTime += (n - maxSubsteps) * dt;
+        n = maxSubsteps;
+        accumulator -= int(accumulator / dt) * dt;
+      } else {
+        accumulator -= n * dt;
+      }
+    }
+    lastSteps = n;
+    steps += n;
+    return n;
+  }
+
+  // How far the render time is between the last two steps, in [0, 1).
+  float alpha() const { return paused ? 1.0f : accumulator / dt; }
+
+  // Pauses if needed and queues exactly one step.
+  void singleStep() {
+    paused = true;
+    pendingSingle++;
+  }
+
+  void togglePause() {
+    paused = !paused;
+    accumulator = 0;
+  }
+
+private:
+  int pendingSingle = 0;
+};
@@ -0,0 +1,495 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <Box2D/Box2D.h>
+
+#include "Platformer.hpp"
+#include "ThreadPool.hpp"
+#include "TripleBuffer.hpp"
+
+// Water as SPH-style particles, stepped after the world and pushing back on
+// its bodies.
+//
+//   Fluid fluid(0, -12, 32, 24);          // the box the particles stay in, m
+//   fluid.pour(2000, b2Vec2(16, 4));
+//   world.Step(dt, ...);
+//   fluid.step(world, dt, &pool);
+//   fluid.publish();                      // for whoever draws fluid.frames
+//
+// The particles follow Clavet et al.'s double density relaxation: they move
+// by their velocities, then are pushed apart wherever they are denser than at
+// rest and pulled together where they are thinner, and take their new
+// velocities from how far they went. A second, short-range density keeps them
+// from clumping. The relaxation is a share of the error per substep rather
+// than a force, so the water stays stable at any step rate.
+//
+// Every substep sorts the particles by the cell of a uniform grid they are
+// in. Cells are h wide, so a particle's neighbours are all in the 3x3 cells
+// around its own, and the particles of a row of cells are contiguous. The
+// rows are split into a fixed number of stripes; every pass only writes the
+// particles of the stripe it works on, so stripes run on the pool without
+// locks, and the result doesn't depend on how many threads there are.
+//
+// Bodies: one QueryAABB per step over the particles' bounds finds the
+// fixtures a box would collide with. A particle closer to one than its
+// radius is pushed out, loses the velocity it had into the fixture and some
+// of the one along it, and the body gets the momentum it lost. The
+// particles within h of a dynamic fixture also tell how much of it is under
+// water, which gives its buoyancy and its drag against the water around it.
+// All of that is summed per stripe and fixture, and applied in order once
+// the step is done.
+//
+// Nothing here is part of world snapshots or replays.
+
+// Particle positions (m) and speeds (m/s), for drawing.
+struct FluidFrame
+{
+  std::vector<float> x, y, speed;
+};
+
+class Fluid
+{
+  // A fixture the particles may touch this step, and the grid cells it
+  // covers, with a margin for the particles' motion.
+  struct Obstacle
+  {
+    b2Fixture* fixture;
+    int col0, col1, row0, row1;
+    float area;       // m²
+    float fullBand;   // particles within h of it when it is under water
+  };
+
+  // What one stripe's particles did to one obstacle's body: momentum over
+  // the whole step, and the particles around it in the last substep.
+  struct Push
+  {
+    b2Vec2 linear;
+    float angular;
+    bool wake;
+    int band;
+    b2Vec2 position, velocity; // sums over the band
+  };
+
+  struct Gather : public b2QueryCallback
+  {
+    std::vector<b2Fixture*>& out;
+    explicit Gather(std::vector<b2Fixture*>& out) : out(out) {}
+
+    bool ReportFixture(b2Fixture* f) override {
+      b2Shape::Type type = f->GetType();
+      if (!f->IsSensor() && (f->GetFilterData().maskBits & categoryOf(Kind::Box)) &&
+          (type == b2Shape::e_circle || type == b2Shape::e_polygon))
+        out.push_back(f);
+      return true;
+    }
+  };
+
+  static const int stripeCount = 16;
+
+  float left, top, right, bottom;
+  float h, spacing, radius;
+  int cols, rows, stripeRows;
+  float restSum; // density of a particle at rest spacing, in kernel sums
+
+  std::vector<float> x, y, vx, vy;
+  std::vector<float> px, py;           // positions before the substep
+  std::vector<float> pressure, nearPressure;
+  std::vector<float> sx, sy;           // relaxation shifts; new velocities in viscosity()
+  std::vector<uint32_t> cell;
+  std::vector<float> tx, ty, tvx, tvy; // sort scratch
+  std::vector<uint32_t> tcell;
+  std::vector<uint32_t> start, next;   // first particle of every cell, and one past the last cell
+
+  std::vector<b2Fixture*> fixtures;
+  std::vector<Obstacle> obstacles;
+  std::vector<Push> pushes;            // stripe-major
+  int stripeContacts[stripeCount];
+
+  float mass() const { return restDensity * spacing * spacing; }
+
+  uint32_t cellAt(float cx, float cy) const {
+    int c = std::max(0, std::min(cols - 1, int((cx - left) / h)));
+    int r = std::max(0, std::min(rows - 1, int((cy - top) / h)));
+    return uint32_t(r * cols + c);
+  }
+
+  template <typename Fn>
+  void forStripes(ThreadPool* pool, Fn fn) {
+    if (pool) pool->parallelFor(stripeCount, fn);
+    else for (int s = 0; s < stripeCount; s++) fn(s);
+  }
+
+  uint32_t stripeBegin(int s) const { return start[size_t(std::min(rows, s * stripeRows) * cols)]; }
+  uint32_t stripeEnd(int s) const { return start[size_t(std::min(rows, (s + 1) * stripeRows) * cols)]; }
+
+  // Calls fn(j, q, dx, dy) for every other particle closer to particle i
+  // than h, where q is the distance over h and (dx, dy) the unit vector from
+  // it to i. A row of three cells is one run of particles.
+  template <typename Fn>
+  void forNeighbours(uint32_t i, Fn fn) const {
+    int c = int(cell[i] % uint32_t(cols)), r = int(cell[i] / uint32_t(cols));
+    int c0 = std::max(0, c - 1), c1 = std::min(cols - 1, c + 1);
+    float h2 = h * h;
+    for (int row = std::max(0, r - 1); row <= std::min(rows - 1, r + 1); row++) {
+      uint32_t end = start[size_t(row * cols + c1 + 1)];
+      for (uint32_t j = start[size_t(row * cols + c0)]; j < end; j++) {
+        float dx = x[i] - x[j], dy = y[i] - y[j], r2 = dx * dx + dy * dy;
+        if (r2 >= h2 || r2 < 1e-12f) continue;
+        float d = std::sqrt(r2);
+        fn(j, d / h, dx / d, dy / d);
+      }
+    }
+  }
+
+  // Counting sort by cell, stable, so the order only depends on positions.
+  void sort() {
+    size_t n = x.size();
+    std::fill(start.begin(), start.end(), 0);
+    for (size_t i = 0; i < n; i++) {
+      cell[i] = cellAt(x[i], y[i]);
+      start[cell[i] + 1]++;
+    }
+    for (size_t c = 1; c < start.size(); c++) start[c] += start[c - 1];
+    next.assign(start.begin(), start.end() - 1);
+    for (size_t i = 0; i < n; i++) {
+      uint32_t k = next[cell[i]]++;
+      tx[k] = x[i]; ty[k] = y[i]; tvx[k] = vx[i]; tvy[k] = vy[i];
+      tcell[k] = cell[i];
+    }
+    x.swap(tx); y.swap(ty); vx.swap(tvx); vy.swap(tvy); cell.swap(tcell);
+  }
+
+  // Gravity, and neighbours that approach each other losing some of that.
+  // New velocities go to sx, sy, since the neighbours' are still being read.
+  void viscosity(int s, float dt, b2Vec2 gravity) {
+    for (uint32_t i = stripeBegin(s); i < stripeEnd(s); i++) {
+      float nvx = vx[i] + gravity.x * dt, nvy = vy[i] + gravity.y * dt;
+      forNeighbours(i, [&](uint32_t j, float q, float dx, float dy) {
+        float u = (vx[j] - vx[i]) * dx + (vy[j] - vy[i]) * dy; // > 0 when closing in
+        if (u <= 0) return;
+        float impulse = std::min(u, dt * (1 - q) * (linearViscosity * u + quadraticViscosity * u * u)) / 2;
+        nvx += impulse * dx;
+        nvy += impulse * dy;
+      });
+      sx[i] = nvx;
+      sy[i] = nvy;
+    }
+  }
+
+  void predict(int s, float dt) {
+    for (uint32_t i = stripeBegin(s); i < stripeEnd(s); i++) {
+      px[i] = x[i];
+      py[i] = y[i];
+      x[i] += vx[i] * dt;
+      y[i] += vy[i] * dt;
+    }
+  }
+
+  void densities(int s) {
+    for (uint32_t i = stripeBegin(s); i < stripeEnd(s); i++) {
+      float density = 0, nearDensity = 0;
+      forNeighbours(i, [&](uint32_t, float q, float, float) {
+        float w = 1 - q;
+        density += w * w;
+        nearDensity += w * w * w;
+      });
+      pressure[i] = stiffness * (density - restSum) / restSum;
+      nearPressure[i] = nearStiffness * nearDensity / restSum;
+    }
+  }
+
+  void relax(int s) {
+    for (uint32_t i = stripeBegin(s); i < stripeEnd(s); i++) {
+      float shiftX = 0, shiftY = 0;
+      forNeighbours(i, [&](uint32_t j, float q, float dx, float dy) {
+        float w = 1 - q;
+        float d = spacing * ((pressure[i] + pressure[j]) * w + (nearPressure[i] + nearPressure[j]) * w * w) / 2;
+        shiftX += d * dx;
+        shiftY += d * dy;
+      });
+      // Two particles on top of each other would fly apart; nothing moves
+      // further than this in one substep.
+      float length = std::sqrt(shiftX * shiftX + shiftY * shiftY), most = maxShift * spacing;
+      float scale = length > most ? most / length : 1;
+      sx[i] = shiftX * scale;
+      sy[i] = shiftY * scale;
+    }
+  }
+
+  // Signed distance from p to the fixture, negative inside, and the
+  // outward normal of the nearest face. For polygons that is the face of
+  // least penetration, exact inside and along faces, close enough at corners.
+  static float separation(b2Fixture* f, b2Vec2 p, b2Vec2& normal) {
+    const b2Transform& xf = f->GetBody()->GetTransform();
+    if (f->GetType() == b2Shape::e_circle) {
+      const b2CircleShape* circle = static_cast<const b2CircleShape*>(f->GetShape());
+      b2Vec2 d = p - b2Mul(xf, circle->m_p);
+      float length = d.Length();
+      normal = length > 1e-6f ? (1 / length) * d : b2Vec2(0, -1);
+      return length - circle->m_radius;
+    }
+    const b2PolygonShape* polygon = static_cast<const b2PolygonShape*>(f->GetShape());
+    b2Vec2 local = b2MulT(xf, p);
+    float best = -FLT_MAX;
+    int face = 0;
+    for (int k = 0; k < polygon->m_count; k++) {
+      float d = b2Dot(polygon->m_normals[k], local - polygon->m_vertices[k]);
+      if (d > best) { best = d; face = k; }
+    }
+    normal = b2Mul(xf.q, polygon->m_normals[face]);
+    return best - polygon->m_radius;
+  }
+
+  // Applies the shifts, takes velocities from the motion, then keeps the
+  // particles out of the obstacles and inside the box.
+  void finish(int s, float dt) {
+    for (uint32_t i = stripeBegin(s); i < stripeEnd(s); i++) {
+      x[i] += sx[i];
+      y[i] += sy[i];
+      vx[i] = (x[i] - px[i]) / dt;
+      vy[i] = (y[i] - py[i]) / dt;
+    }
+
+    int r0 = s * stripeRows, r1 = std::min(rows, r0 + stripeRows) - 1;
+    float m = mass();
+    for (size_t k = 0; k < obstacles.size(); k++) {
+      const Obstacle& o = obstacles[k];
+      b2Body* body = o.fixture->GetBody();
+      bool dynamic = body->GetType() == b2_dynamicBody;
+      Push& push = pushes[size_t(s) * obstacles.size() + k];
+      push.band = 0;
+      push.position = push.velocity = b2Vec2(0, 0);
+      for (int row = std::max(r0, o.row0); row <= std::min(r1, o.row1); row++) {
+        uint32_t end = start[size_t(row * cols + o.col1 + 1)];
+        for (uint32_t i = start[size_t(row * cols + o.col0)]; i < end; i++) {
+          b2Vec2 p(x[i], y[i]), n;
+          float sep = separation(o.fixture, p, n);
+          if (sep >= h) continue;
+          if (dynamic) {
+            push.band++;
+            push.position += p;
+            push.velocity += b2Vec2(vx[i], vy[i]);
+          }
+          if (sep >= radius) continue;
+          b2Vec2 rel = b2Vec2(vx[i], vy[i]) - body->GetLinearVelocityFromWorldPoint(p);
+          float vn = b2Dot(rel, n);
+          b2Vec2 dv = -friction * (rel - vn * n);
+          if (vn < 0) dv -= (1 + restitution) * vn * n;
+          vx[i] += dv.x; vy[i] += dv.y;
+          x[i] += (radius - sep) * n.x;
+          y[i] += (radius - sep) * n.y;
+          stripeContacts[s]++;
+          if (!dynamic) continue;
+          b2Vec2 impulse = -m * dv;
+          push.linear += impulse;
+          push.angular += b2Cross(p - body->GetWorldCenter(), impulse);
+          push.wake = push.wake || vn < -wakeSpeed;
+        }
+      }
+    }
+
+    for (uint32_t i = stripeBegin(s); i < stripeEnd(s); i++) {
+      float cx = std::max(left + radius, std::min(right - radius, x[i]));
+      float cy = std::max(top + radius, std::min(bottom - radius, y[i]));
+      if (cx != x[i]) { x[i] = cx; vx[i] = 0; vy[i] *= 1 - friction; }
+      if (cy != y[i]) { y[i] = cy; vy[i] = 0; vx[i] *= 1 - friction; }
+    }
+  }
+
+  // The fixtures near any particle, as of now.
+  void gather(b2World& world, float margin) {
+    b2AABB box;
+    box.lowerBound.Set(FLT_MAX, FLT_MAX);
+    box.upperBound.Set(-FLT_MAX, -FLT_MAX);
+    for (size_t i = 0; i < x.size(); i++) {
+      box.lowerBound.Set(std::min(box.lowerBound.x, x[i]), std::min(box.lowerBound.y, y[i]));
+      box.upperBound.Set(std::max(box.upperBound.x, x[i]), std::max(box.upperBound.y, y[i]));
+    }
+    box.lowerBound -= b2Vec2(margin, margin);
+    box.upperBound += b2Vec2(margin, margin);
+
+    fixtures.clear();
+    Gather gather(fixtures);
+    world.QueryAABB(&gather, box);
+
+    obstacles.clear();
+    for (b2Fixture* f : fixtures) {
+      const b2AABB& a = f->GetAABB(0);
+      Obstacle o;
+      o.fixture = f;
+      uint32_t low = cellAt(a.lowerBound.x - margin, a.lowerBound.y - margin);
+      uint32_t high = cellAt(a.upperBound.x + margin, a.upperBound.y + margin);
+      o.col0 = int(low % uint32_t(cols)); o.row0 = int(low / uint32_t(cols));
+      o.col1 = int(high % uint32_t(cols)); o.row1 = int(high / uint32_t(cols));
+
+      b2MassData md;
+      f->GetShape()->ComputeMass(&md, 1);
+      o.area = md.mass;
+      float perimeter = 0;
+      if (f->GetType() == b2Shape::e_circle) {
+        perimeter = 2 * b2_pi * f->GetShape()->m_radius;
+      } else {
+        const b2PolygonShape* polygon = static_cast<const b2PolygonShape*>(f->GetShape());
+        for (int k = 0; k < polygon->m_count; k++)
+          perimeter += b2Distance(polygon->m_vertices[k], polygon->m_vertices[(k + 1) % polygon->m_count]);
+      }
+      o.fullBand = (perimeter + b2_pi * h) * (h - radius) / (spacing * spacing);
+      obstacles.push_back(o);
+    }
+    pushes.assign(size_t(stripeCount) * obstacles.size(), Push{ b2Vec2(0, 0), 0, false, 0, b2Vec2(0, 0), b2Vec2(0, 0) });
+  }
+
+  // Per dynamic fixture, the momentum the particles gave it, and buoyancy
+  // and drag for the share of it that is under water, over dt.
+  void push(b2Vec2 gravity, float dt) {
+    for (size_t k = 0; k < obstacles.size(); k++) {
+      const Obstacle& o = obstacles[k];
+      b2Body* body = o.fixture->GetBody();
+      if (body->GetType() != b2_dynamicBody) continue;
+      Push sum{ b2Vec2(0, 0), 0, false, 0, b2Vec2(0, 0), b2Vec2(0, 0) };
+      for (int s = 0; s < stripeCount; s++) {
+        const Push& p = pushes[size_t(s) * obstacles.size() + k];
+        sum.linear += p.linear;
+        sum.angular += p.angular;
+        sum.wake = sum.wake || p.wake;
+        sum.band += p.band;
+        sum.position += p.position;
+        sum.velocity += p.velocity;
+      }
+      if (sum.band > 0) {
+        float submerged = std::min(1.0f, sum.band / o.fullBand);
+        b2Vec2 center = (1.0f / sum.band) * sum.position;
+        b2Vec2 water = (1.0f / sum.band) * sum.velocity;
+        float share = o.fixture->GetDensity() * o.area / body->GetMass(); // of the body, for compound ones
+        b2Vec2 impulse = -(restDensity * o.area * submerged * dt) * gravity;
+        impulse += -(drag * submerged * share * body->GetMass() * dt) * (body->GetLinearVelocity() - water);
+        body->ApplyLinearImpulse(impulse, center, false);
+        body->ApplyAngularImpulse(-drag * submerged * share * body->GetInertia() * dt * body->GetAngularVelocity(), false);
+      }
+      if (sum.linear.x != 0 || sum.linear.y != 0 || sum.angular != 0) {
+        body->ApplyLinearImpulseToCenter(sum.linear, sum.wake);
+        body->ApplyAngularImpulse(sum.angular, sum.wake);
+      }
+    }
+  }
+
+public:
+  float restDensity = 1;          // kg/m², on the scale of fixture densities
+  float stiffness = 0.1f;         // share of a density error undone per substep
+  float nearStiffness = 0.2f;     // the same for crowding
+  float maxShift = 0.1f;          // in rest spacings per substep
+  float linearViscosity = 2;      // 1/s
+  float quadraticViscosity = 0.5f; // 1/m
+  float friction = 0.1f;          // share of the velocity along a body lost per contact
+  float restitution = 0;
+  float drag = 2;                 // 1/s; how fast a body under water takes the water's velocity
+  float wakeSpeed = 0.2f;         // m/s into a sleeping body that wakes it; floating alone doesn't
+  int maxParticles = 65536;
+  int maxSubsteps = 8;
+
+  int contacts = 0;               // particle-fixture contacts in the last step
+  int substeps = 0;               // in the last step
+
+  TripleBuffer<FluidFrame> frames;
+
+  // Particles stay inside [left, right] x [top, bottom], in m. h is the
+  // interaction radius; particles are at half of it from their neighbours
+  // at rest.
+  Fluid(float left, float top, float right, float bottom, float h = 0.25f)
+    : left(left), top(top), right(right), bottom(bottom), h(h), spacing(h / 2), radius(h / 4) {
+    cols = std::max(1, int(std::ceil((right - left) / h)));
+    rows = std::max(1, int(std::ceil((bottom - top) / h)));
+    stripeRows = (rows + stripeCount - 1) / stripeCount;
+    start.assign(size_t(cols * rows + 1), 0);
+
+    restSum = 0;
+    for (int j = -2; j <= 2; j++) {
+      for (int i = -2; i <= 2; i++) {
+        float q = std::sqrt(float(i * i + j * j)) * spacing / h;
+        if (q > 0 && q < 1) restSum += (1 - q) * (1 - q);
+      }
+    }
+  }
+
+  int count() const { return int(x.size()); }
+  float particleSpacing() const { return spacing; } // m, at rest
+
+  void add(b2Vec2 p, b2Vec2 v = b2Vec2(0, 0)) {
+    if (count() >= maxParticles) return;
+    x.push_back(std::max(left + radius, std::min(right - radius, p.x)));
+    y.push_back(std::max(top + radius, std::min(bottom - radius, p.y)));
+    vx.push_back(v.x);
+    vy.push_back(v.y);
+    for (std::vector<float>* a : { &px, &py, &pressure, &nearPressure, &sx, &sy, &tx, &ty, &tvx, &tvy })
+      a->push_back(0);
+    cell.push_back(0);
+    tcell.push_back(0);
+  }
+
+  // A square of n particles at rest spacing around center. The lattice is
+  // nudged a little, the same way every time, so it doesn't stack.
+  void pour(int n, b2Vec2 center) {
+    int side = int(std::ceil(std::sqrt(float(n))));
+    for (int k = 0; k < n; k++) {
+      float jitter = float(k * 7919 % 11 - 5) * 0.01f * spacing;
+      add(center + b2Vec2((k % side - side / 2) * spacing + jitter, (k / side - side / 2) * spacing));
+    }
+  }
+
+  void clear() {
+    for (std::vector<float>* a : { &x, &y, &vx, &vy, &px, &py, &pressure, &nearPressure, &sx, &sy,
+                                   &tx, &ty, &tvx, &tvy })
+      a->clear();
+    cell.clear();
+    tcell.clear();
+    contacts = 0;
+  }
+
+  // One step of dt, in as many substeps as keep the fastest particle from
+  // crossing more than a quarter cell in one, up to maxSubsteps. Call after
+  // world.Step; the bodies get the water's impulses, which the next
+  // world.Step sees.
+  void step(b2World& world, float dt, ThreadPool* pool = nullptr) {
+    contacts = 0;
+    substeps = 0;
+    if (x.empty()) return;
+
+    float fastest = 0;
+    for (size_t i = 0; i < x.size(); i++) fastest = std::max(fastest, vx[i] * vx[i] + vy[i] * vy[i]);
+    fastest = std::sqrt(fastest);
+    substeps = std::max(1, std::min(maxSubsteps, int(std::ceil(dt * fastest / (0.25f * h)))));
+    float sub = dt / substeps;
+
+    sort();
+    gather(world, h + fastest * dt);
+    std::fill(stripeContacts, stripeContacts + stripeCount, 0);
+    b2Vec2 gravity = world.GetGravity();
+    for (int k = 0; k < substeps; k++) {
+      if (k > 0) sort();
+      forStripes(pool, [&](int s) { viscosity(s, sub, gravity); });
+      vx.swap(sx);
+      vy.swap(sy);
+      forStripes(pool, [&](int s) { predict(s, sub); });
+      forStripes(pool, [&](int s) { densities(s); });
+      forStripes(pool, [&](int s) { relax(s); });
+      forStripes(pool, [&](int s) { finish(s, sub); });
+    }
+
+    for (int s = 0; s < stripeCount; s++) contacts += stripeContacts[s];
+    push(gravity, dt);
+  }
+
+  void publish() {
+    FluidFrame& f = frames.writeBuffer();
+    f.x = x;
+    f.y = y;
+    f.speed.resize(x.size());
+    for (size_t i = 0; i < x.size(); i++) f.speed[i] = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+    frames.publish();
+  }
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Level geometry. Levels are written by hand as text and compiled by
+// tools/levelc into a flat binary, which the game maps and builds in one
+// pass.
+//
+// Text, one body per line; lines starting with "#" are comments, sizes and
+// positions are in pixels, colors are a name or #rrggbb:
+//
+//   <static|dynamic> <name> <kind> <x> <y> <width> <height> <color> [density friction restitution]
+//   static  ground  Scenery  512 761.6  1024 12.8  white
+//   dynamic redBox  Box      256 0      51.2 51.2  red    1 0.1 0
+//
+// Binary, little endian, every array bodyCount long:
+//
+//   LevelHeader | LevelBody[] | LevelFixture[] | LevelVisual[] | names
+//
+// names holds the NUL-terminated body names that LevelVisual::name points
+// into. Static Scenery bodies are what a level has thousands of; the game
+// merges them into a single Box2D body and a single vertex array.
+
+// What a fixture belongs to. The game keeps it in the fixture's userData for
+// the contact listener and uses it as the b2Filter category.
+enum class Kind : uint8_t { Scenery, LeftWall, RightWall, Exit, Player, Box, Count };
+
+const char* const kindNames[int(Kind::Count)] = { "Scenery", "LeftWall", "RightWall", "Exit", "Player", "Box" };
+
+const char levelMagic[8] = { 'B', '2', 'L', 'E', 'V', 'E', 'L', 0 };
+const uint32_t levelVersion = 1;
+
+struct LevelHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t bodyCount;
+  uint32_t namesSize;
+  uint32_t reserved[3];
+};
+
+struct LevelBody
+{
+  uint8_t dynamic;
+  uint8_t kind;
+  uint16_t reserved;
+  float x, y; // center
+};
+
+struct LevelFixture
+{
+  float halfWidth, halfHeight;
+  float density, friction, restitution;
+};
+
+struct LevelVisual
+{
+  float width, height;
+  uint32_t color; // 0xRRGGBBAA
+  uint32_t name;  // offset into names
+};
+
+static_assert(sizeof(LevelHeader) == 32, "LevelHeader must stay 32 bytes");
+static_assert(sizeof(LevelBody) == 12, "LevelBody must stay 12 bytes");
+static_assert(sizeof(LevelFixture) == 20, "LevelFixture must stay 20 bytes");
+static_assert(sizeof(LevelVisual) == 16, "LevelVisual must stay 16 bytes");
+
+// A compiled level in memory (a mapping, usually). Doesn't own the bytes.
+class LevelView
+{
+  const uint8_t* bytes = nullptr;
+
+public:
+  // Checks the header, that every array fits in size and that every kind
+  // and name offset is in range.
+  bool open(const uint8_t* data, size_t size) {
+    bytes = nullptr;
+    if (size < sizeof(LevelHeader)) return false;
+    const LevelHeader* h = (const LevelHeader*)data;
+    if (memcmp(h->magic, levelMagic, sizeof(levelMagic)) != 0 || h->version != levelVersion) return false;
+    uint64_t need = sizeof(LevelHeader) +
+      uint64_t(h->bodyCount) * (sizeof(LevelBody) + sizeof(LevelFixture) + sizeof(LevelVisual)) + h->namesSize;
+    if (need > size || h->namesSize == 0 || data[need - 1] != 0) return false;
+    bytes = data;
+    for (uint32_t i = 0; i < count(); i++) {
+      if (bodies()[i].kind >= uint8_t(Kind::Count) || visuals()[i].name >= namesSize()) {
+        bytes = nullptr;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const uint8_t* data() const { return bytes; }
+  size_t size() const {
+    return sizeof(LevelHeader) + size_t(count()) * (sizeof(LevelBody) + sizeof(LevelFixture) + sizeof(LevelVisual)) +
+      namesSize();
+  }
+
+  const LevelHeader& header() const { return *(const LevelHeader*)bytes; }
+  uint32_t count() const { return header().bodyCount; }
+
+  const LevelBody* bodies() const { return (const LevelBody*)(bytes + sizeof(LevelHeader)); }
+  const LevelFixture* fixtures() const { return (const LevelFixture*)(bodies() + count()); }
+  const LevelVisual* visuals() const { return (const LevelVisual*)(fixtures() + count()); }
+  const char* names() const { return (const char*)(visuals() + count()); }
+  uint32_t namesSize() const { return header().namesSize; }
+};
+
+inline bool parseLevelColor(const std::string& s, uint32_t& rgba)
+{
+  struct Named { const char* name; uint32_t rgba; };
+  static const Named named[] = {
+    { "white", 0xFFFFFFFF }, { "black", 0x000000FF }, { "red", 0xFF0000FF }, { "green", 0x00FF00FF },
+    { "blue", 0x0000FFFF }, { "yellow", 0xFFFF00FF }, { "magenta", 0xFF00FFFF }, { "cyan", 0x00FFFFFF },
+  };
+  for (const Named& n : named)
+    if (s == n.name) { rgba = n.rgba; return true; }
+  if (s.size() != 7 || s[0] != '#') return false;
+  char* end;
+  unsigned long rgb = strtoul(s.c_str() + 1, &end, 16);
+  if (*end) return false;
+  rgba = uint32_t(rgb << 8) | 0xFF;
+  return true;
+}
+
+// Compiles the text form into the binary form. On failure, error names the
+// offending line.
+inline bool compileLevel(std::istream& in, std::vector<uint8_t>& out, std::string& error)
+{
+  std::vector<LevelBody> bodies;
+  std::vector<LevelFixture> fixtures;
+  std::vector<LevelVisual> visuals;
+  std::string names;
+
+  std::string line;
+  for (int lineNo = 1; std::getline(in, line); lineNo++) {
+    std::istringstream words(line);
+    std::string type, name, kind, color;
+    if (!(words >> type) || type[0] == '#') continue;
+
+    LevelBody b = {};
+    LevelFixture f = {};
+    LevelVisual v = {};
+    f.friction = 0.2f; // b2FixtureDef's default
+
+    bool ok = bool(words >> name >> kind >> b.x >> b.y >> v.width >> v.height >> color);
+    if (ok && (type == "static" || type == "dynamic")) {
+      b.dynamic = type == "dynamic";
+      if (b.dynamic && !(words >> f.density >> f.friction >> f.restitution))
+        f = { 0, 0, 1.0f, 0.2f, 0 };
+    } else {
+      ok = false;
+    }
+    int k = 0;
+    while (k < int(Kind::Count) && kind != kindNames[k]) k++;
+    ok = ok && k < int(Kind::Count) && parseLevelColor(color, v.color) && v.width > 0 && v.height > 0;
+    if (!ok) {
+      error = "line " + std::to_string(lineNo) + ": " + line;
+      return false;
+    }
+    b.kind = uint8_t(k);
+    f.halfWidth = v.width * 0.5f;
+    f.halfHeight = v.height * 0.5f;
+    v.name = uint32_t(names.size());
+    names.append(name);
+    names.push_back(0);
+
+    bodies.push_back(b);
+    fixtures.push_back(f);
+    visuals.push_back(v);
+  }
+  if (names.empty()) names.push_back(0);
+
+  LevelHeader h = {};
+  memcpy(h.magic, levelMagic, sizeof(levelMagic));
+  h.version = levelVersion;
+  h.bodyCount = uint32_t(bodies.size());
+  h.namesSize = uint32_t(names.size());
+
+  out.clear();
+  auto put = [&](const void* p, size_t n) { out.insert(out.end(), (const uint8_t*)p, (const uint8_t*)p + n); };
+  put(&h, sizeof(h));
+  put(bodies.data(), bodies.size() * sizeof(LevelBody));
+  put(fixtures.data(), fixtures.size() * sizeof(LevelFixture));
+  put(visuals.data(), visuals.size() * sizeof(LevelVisual));
+  put(names.data(), names.size());
+  return true;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <SFML/System.hpp>
+
+#include "FixedStep.hpp"
+#include "Profiler.hpp"
+#include "TripleBuffer.hpp"
+
+// Where the moving bodies were before and after the last step of a frame,
+// one array per field, so the renderer streams through them. Only the
+// bodies the capture chose to send are in it; see PhysicsLoop::consumed.
+struct TransformFrame
+{
+  std::vector<uint32_t> ids; // whatever the capture uses to find the body again
+  std::vector<float> px, py, pangle;
+  std::vector<float> x, y, angle;
+  double time = 0;       // wall clock (PhysicsLoop::now) at which the state is current;
+                         // far in the past while paused, so it shows as is
+  float dt = 1;
+  float timeScale = 1;
+  uint64_t step = 0;
+  uint64_t number = 0;   // counts publishes
+  int epoch = 0;         // the capture's own, to tell frames of an older set of bodies
+
+  size_t size() const { return ids.size(); }
+
+  void clear() {
+    ids.clear();
+    px.clear(); py.clear(); pangle.clear();
+    x.clear(); y.clear(); angle.clear();
+  }
+
+  void push(uint32_t id, float px0, float py0, float pangle0, float x1, float y1, float angle1) {
+    ids.push_back(id);
+    px.push_back(px0); py.push_back(py0); pangle.push_back(pangle0);
+    x.push_back(x1); y.push_back(y1); angle.push_back(angle1);
+  }
+
+  // Blend factor for rendering at wall-clock time t.
+  float alpha(double t) const {
+    return std::max(0.0f, std::min(1.0f, float((t - time) * timeScale / dt)));
+  }
+};
+
+// Drives the fixed-step simulation either on its own thread or inline from
+// the render loop, and hands the resulting transforms to the renderer through
+// a triple buffer, so rendering never waits for physics or the reverse.
+//
+// step runs one fixed step; capture fills a TransformFrame from the world.
+// Both are called with mutex held, from the physics thread when threaded.
+// Anything else that touches the world, the stepper settings or the
+// registry's structure must hold mutex too.
+class PhysicsLoop
+{
+  std::thread thread;
+  std::atomic<bool> running{false};
+  uint64_t published = 0;
+  std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+  double lastTick = -1;
+
+  void run() {
+    Profiler::get().setThreadName("physics");
+    while (running) {
+      tick();
+      // Sleep until the next step is due, but stay responsive to pause
+      // and single-step requests.
+      double wait;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        wait = stepper.paused ? 0.001 : (stepper.dt - stepper.accumulator) / stepper.timeScale;
+      }
+      sf::sleep(sf::seconds(float(std::max(0.0005, std::min(wait, 0.005)))));
+    }
+  }
+
+public:
+  FixedStep stepper;
+  std::mutex mutex;
+  std::function<void()> step;
+  std::function<void(TransformFrame&)> capture;
+  TripleBuffer<TransformFrame> frames;
+  std::atomic<float> stepMs{0}; // cost of the last tick's steps
+
+  // The number of the newest frame the renderer has applied. A capture may
+  // leave out bodies that have been still since before that frame, since
+  // the renderer already shows them where they are.
+  std::atomic<uint64_t> consumed{0};
+
+  ~PhysicsLoop() { stop(); }
+
+  double now() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+  }
+
+  // Runs the steps that are due and publishes the result if any ran.
+  void tick() {
+    std::lock_guard<std::mutex> lock(mutex);
+    double t = now();
+    float frameTime = lastTick < 0 ? 0 : float(t - lastTick);
+    lastTick = t;
+
+    int n = stepper.advance(frameTime);
+    if (n == 0) return;
+    {
+      PROFILE_ZONE("physics steps");
+      for (int i = 0; i < n; i++) step();
+    }
+    stepMs = float((now() - t) * 1000);
+    publish(t);
+  }
+
+  // Hands the world as it is now to the renderer. tick() does this after
+  // stepping; call it with mutex held after moving bodies some other way.
+  void publish(double t) {
+    TransformFrame& f = frames.writeBuffer();
+    f.clear();
+    f.number = ++published;
+    capture(f);
+    f.time = stepper.paused ? -1e30 : t - stepper.accumulator / stepper.timeScale;
+    f.dt = stepper.dt;
+    f.timeScale = stepper.timeScale;
+    f.step = stepper.steps;
+    frames.publish();
+  }
+
+  bool threaded() const { return thread.joinable(); }
+
+  void start() {
+    if (threaded()) return;
+    running = true;
+    thread = std::thread([this] { run(); });
+  }
+
+  void stop() {
+    running = false;
+    if (thread.joinable()) thread.join();
+  }
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+#include <Box2D/Box2D.h>
+
+#include "Level.hpp"
+
+// The platformer's rules, shared by the game and by the headless sweep and
+// replay tools, so that all of them build a world the same way; the
+// characters that move in it are in Character.hpp. Nothing in here knows
+// about rendering, the registry or a particular b2World.
+
+const float PPM = 32.0f; // pixels per meter; levels are laid out in pixels
+
+// Everything a designer may want to sweep. Defaults are the game's.
+struct Tuning
+{
+  float gravity = 0.3f;
+  float jumpSpeed = 1.35f;     // m/s, upwards
+  int maxJumps = 2;            // before touching something again
+  float runSpeed = 0.3f;       // m/s
+  float spin = 20;             // deg/s while running
+  float wallKick = 1.0f;       // off a wall, in player masses (twice that off the right wall)
+  float wallLift = 0.01f;      // in player masses
+  float playerSize = 25.6f;    // px
+  float playerDensity = 0.3f;
+  float playerFriction = 0.3f;
+  float playerRestitution = 0.3f;
+  float stepHz = 130;
+  int velocityIterations = 6;
+  int positionIterations = 2;
+};
+
+// Fixtures keep their Kind in userData, so that the contact listener can
+// tell the player from a box without looking anything up. Each kind is also
+// one b2Filter category bit.
+inline uint16 categoryOf(Kind k) { return uint16(1u << unsigned(k)); }
+
+// Which categories each kind collides with. The exit only matters to the
+// player, so boxes pass through it and never produce a contact with it.
+const uint16 everything = 0xFFFF;
+const uint16 collidesWith[int(Kind::Count)] = {
+  everything,                 // Scenery
+  everything,                 // LeftWall
+  everything,                 // RightWall
+  categoryOf(Kind::Player),   // Exit
+  everything,                 // Player
+  uint16(everything & ~categoryOf(Kind::Exit)), // Box
+};
+
+// The low byte; characters keep their index above it (see Character.hpp).
+inline Kind kindOf(b2Fixture* f) { return Kind(f->GetUserData().pointer & 0xFF); }
+
+inline void setKind(b2FixtureDef& def, Kind kind) {
+  def.userData.pointer = uintptr_t(kind);
+  def.filter.categoryBits = categoryOf(kind);
+  def.filter.maskBits = collidesWith[int(kind)];
+}
+
+// Body and fixture definitions of one box, in pixels.
+struct Recipe
+{
+  b2BodyDef def;
+  b2PolygonShape shape;
+  b2FixtureDef fixtureDef;
+  float xinit, yinit;
+
+  b2Body* build(b2World& world) {
+    fixtureDef.shape = &shape; // the recipe may have moved since the last build
+    b2Body* body = world.CreateBody(&def);
+    body->CreateFixture(&fixtureDef);
+    return body;
+  }
+};
+
+inline Recipe boxRecipe(Kind kind, float width, float height, float xinit, float yinit) {
+  Recipe r;
+  r.xinit = xinit; r.yinit = yinit;
+  r.def.position.Set(xinit / PPM, yinit / PPM);
+  r.shape.SetAsBox(width * .5f / PPM, height * .5f / PPM);
+  setKind(r.fixtureDef, kind);
+  return r;
+}
+
+// One non-Scenery body of a level.
+inline Recipe levelRecipe(const LevelBody& b, const LevelFixture& f) {
+  Recipe r = boxRecipe(Kind(b.kind), f.halfWidth * 2, f.halfHeight * 2, b.x, b.y);
+  if (b.dynamic) r.def.type = b2_dynamicBody;
+  r.fixtureDef.density = f.density;
+  r.fixtureDef.friction = f.friction;
+  r.fixtureDef.restitution = f.restitution;
+  return r;
+}
+
+// Dynamic level bodies start at a random angle. Levels are built with a
+// seeded generator, so the same seed gives the same angles everywhere.
+inline void randomizeAngle(Recipe& r, std::minstd_rand& rng) {
+  if (r.def.type == b2_dynamicBody) r.def.angle = rng() % 360 * b2_pi / 180;
+}
+
+inline bool isScenery(const LevelBody& b) { return !b.dynamic && Kind(b.kind) == Kind::Scenery; }
+
+// All static Scenery tiles of a level as fixtures of one body.
+inline b2Body* buildScenery(b2World& world, const LevelView& level) {
+  b2BodyDef def;
+  b2Body* scenery = world.CreateBody(&def);
+  b2PolygonShape shape;
+  b2FixtureDef fixtureDef;
+  fixtureDef.shape = &shape;
+  setKind(fixtureDef, Kind::Scenery);
+  for (uint32_t i = 0; i < level.count(); i++) {
+    const LevelBody& b = level.bodies()[i];
+    const LevelFixture& f = level.fixtures()[i];
+    if (!isScenery(b)) continue;
+    shape.SetAsBox(f.halfWidth / PPM, f.halfHeight / PPM, b2Vec2(b.x / PPM, b.y / PPM), 0);
+    fixtureDef.friction = f.friction;
+    fixtureDef.restitution = f.restitution;
+    scenery->CreateFixture(&fixtureDef);
+  }
+  return scenery;
+}
+
+inline Recipe playerRecipe(const Tuning& t) {
+  Recipe r = boxRecipe(Kind::Player, t.playerSize, t.playerSize, 102.4f, 0.0f);
+  r.def.type = b2_dynamicBody;
+  r.fixtureDef.density = t.playerDensity;
+  r.fixtureDef.friction = t.playerFriction;
+  r.fixtureDef.restitution = t.playerRestitution;
+  return r;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <Box2D/Box2D.h>
+
+#include "Level.hpp"
+#include "Character.hpp"
+#include "Platformer.hpp"
+
+// A recorded session: where it started and the player's input at every
+// fixed step, with a hash of the world after that step. Playing it back
+// from a fresh world built the same way (platformerStep) must give the
+// same hashes; the first step that doesn't is where the physics diverged.
+//
+// File, little endian:
+//
+//   ReplayHeader | ReplayStep[stepCount]
+
+const char replayMagic[8] = { 'B', '2', 'R', 'E', 'P', 'L', 'A', 'Y' };
+const uint32_t replayVersion = 1;
+
+struct ReplayHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t seed;       // of the level's body angles (randomizeAngle)
+  uint64_t levelHash;  // levelHash() of the level played
+  char level[64];      // its path as loaded, NUL-terminated
+  Tuning tuning;
+  float dt;            // the step actually used; tuning.stepHz is rounded
+  uint32_t stepCount;
+};
+
+struct ReplayStep
+{
+  StepInput input;
+  uint32_t reserved;
+  uint64_t hash;       // worldHash() after the step
+};
+
+static_assert(sizeof(Tuning) == 56, "Tuning is part of the replay format");
+static_assert(sizeof(ReplayHeader) == 152, "ReplayHeader must stay 152 bytes");
+static_assert(sizeof(ReplayStep) == 16, "ReplayStep must stay 16 bytes");
+
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t h = 14695981039346656037ull)
+{
+  const uint8_t* p = (const uint8_t*)data;
+  for (size_t i = 0; i < size; i++) h = (h ^ p[i]) * 1099511628211ull;
+  return h;
+}
+
+inline uint64_t levelHash(const LevelView& level) { return fnv1a(level.data(), level.size()); }
+
+// The bit patterns of every enabled dynamic body's transform and velocities,
+// in body-list order. Two worlds that stepped alike hash alike; the least
+// drift doesn't.
+inline uint64_t worldHash(b2World& world)
+{
+  uint64_t h = fnv1a(nullptr, 0);
+  for (b2Body* b = world.GetBodyList(); b; b = b->GetNext()) {
+    if (b->GetType() != b2_dynamicBody || !b->IsEnabled()) continue;
+    const b2Transform& xf = b->GetTransform();
+    const b2Vec2& v = b->GetLinearVelocity();
+    float state[] = { xf.p.x, xf.p.y, xf.q.s, xf.q.c, v.x, v.y, b->GetAngularVelocity() };
+    h = fnv1a(state, sizeof(state), h);
+  }
+  return h;
+}
+
+class Replay
+{
+public:
+  ReplayHeader header = {};
+  std::vector<ReplayStep> steps;
+
+  // Starts over, for a session about to be recorded from a fresh world.
+  void begin(const std::string& levelPath, uint64_t levelHash, unsigned seed, const Tuning& tuning, float dt) {
+    header = {};
+    memcpy(header.magic, replayMagic, sizeof(replayMagic));
+    header.version = replayVersion;
+    header.seed = seed;
+    header.levelHash = levelHash;
+    strncpy(header.level, levelPath.c_str(), sizeof(header.level) - 1);
+    header.tuning = tuning;
+    header.dt = dt;
+    steps.clear();
+  }
+
+  bool save(const std::string& path) const {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    ReplayHeader h = header;
+    h.stepCount = uint32_t(steps.size());
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+      fwrite(steps.data(), sizeof(ReplayStep), steps.size(), f) == steps.size();
+    return fclose(f) == 0 && ok;
+  }
+
+  bool load(const std::string& path, std::string& error) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+      error = path + ": can't read";
+      return false;
+    }
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+      memcmp(header.magic, replayMagic, sizeof(replayMagic)) == 0 && header.version == replayVersion;
+    if (ok) {
+      header.level[sizeof(header.level) - 1] = 0;
+      steps.resize(header.stepCount);
+      ok = fread(steps.data(), sizeof(ReplayStep), steps.size(), f) == steps.size();
+    }
+    fclose(f);
+    if (!ok) error = path + ": not a replay";
+    return ok;
+  }
+};
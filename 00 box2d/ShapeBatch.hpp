@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <SFML/Graphics.hpp>
+
+// Many small boxes and discs as the triangles of one vertex buffer, drawn
+// with one call. Every shape keeps its own run of vertices (a slot) for as
+// long as it exists. Moving a shape rewrites only its run, and draw() only
+// uploads the runs touched since the last draw, so shapes that stand still
+// cost nothing per frame.
+//
+//   ShapeBatch batch;
+//   uint32_t s = batch.add(Vector2f(20, 20), false, Color::Red); // hidden
+//   batch.place(s, Vector2f(100, 100), angle);                   // radians
+//   batch.touch(s);
+//   batch.draw(window);
+//
+// place() writes nothing but the slot's own vertices, so different slots may
+// be placed from different threads; everything else, touch() included, is
+// for one thread. The GL buffer is only made by the first draw(), so a batch
+// may be a global; without vertex buffer support it draws from memory.
+class ShapeBatch
+{
+  struct Slot { uint32_t first, count; bool live, dirty; };
+
+  std::vector<sf::Vector2f> local; // per vertex, around the shape's center
+  std::vector<sf::Vertex> vertices;
+  std::vector<Slot> slots;
+  std::map<uint32_t, std::vector<uint32_t>> freeSlots; // by vertex count
+  std::vector<uint32_t> dirty;
+  std::unique_ptr<sf::VertexBuffer> buffer;
+  sf::VertexBuffer::Usage usage;
+  bool resized = false;
+  size_t uploaded = 0;
+  uint64_t changes = 0;
+
+  // Dirty runs this close together go up as one update.
+  static const uint32_t mergeGap = 64;
+
+public:
+  static const int circleSegments = 8;
+
+  explicit ShapeBatch(sf::VertexBuffer::Usage usage = sf::VertexBuffer::Stream) : usage(usage) {}
+
+  // A box of size, or a disc of diameter size.x. Hidden until placed.
+  uint32_t add(sf::Vector2f size, bool round, sf::Color color) {
+    uint32_t count = round ? circleSegments * 3 : 6;
+    uint32_t slot;
+    std::vector<uint32_t>& reusable = freeSlots[count];
+    if (!reusable.empty()) {
+      slot = reusable.back();
+      reusable.pop_back();
+    } else {
+      slot = uint32_t(slots.size());
+      slots.push_back({ uint32_t(vertices.size()), count, false, false });
+      vertices.resize(vertices.size() + count);
+      local.resize(local.size() + count);
+      resized = true;
+    }
+    Slot& s = slots[slot];
+    s.live = true;
+
+    sf::Vector2f* l = &local[s.first];
+    if (round) {
+      float r = size.x * .5f;
+      for (int i = 0; i < circleSegments; i++) {
+        float a0 = i * 2 * 3.14159265f / circleSegments, a1 = (i + 1) * 2 * 3.14159265f / circleSegments;
+        l[3 * i] = sf::Vector2f();
+        l[3 * i + 1] = sf::Vector2f(r * std::cos(a0), r * std::sin(a0));
+        l[3 * i + 2] = sf::Vector2f(r * std::cos(a1), r * std::sin(a1));
+      }
+    } else {
+      float hw = size.x * .5f, hh = size.y * .5f;
+      l[0] = sf::Vector2f(-hw, -hh); l[1] = sf::Vector2f(hw, -hh); l[2] = sf::Vector2f(hw, hh);
+      l[3] = sf::Vector2f(-hw, -hh); l[4] = sf::Vector2f(hw, hh); l[5] = sf::Vector2f(-hw, hh);
+    }
+    for (uint32_t i = 0; i < count; i++) vertices[s.first + i].color = color;
+    hide(slot);
+    return slot;
+  }
+
+  // Hides the shape and lets add() hand its slot out again. Placing a
+  // removed slot does nothing.
+  void remove(uint32_t slot) {
+    hide(slot);
+    slots[slot].live = false;
+    freeSlots[slots[slot].count].push_back(slot);
+  }
+
+  void place(uint32_t slot, sf::Vector2f position, float angle) {
+    const Slot& s = slots[slot];
+    if (!s.live) return;
+    float c = std::cos(angle), sn = std::sin(angle);
+    for (uint32_t i = s.first; i < s.first + s.count; i++) {
+      const sf::Vector2f& l = local[i];
+      vertices[i].position = position + sf::Vector2f(c * l.x - sn * l.y, sn * l.x + c * l.y);
+    }
+  }
+
+  // Marks a slot for upload by the next draw().
+  void touch(uint32_t slot) {
+    changes++;
+    Slot& s = slots[slot];
+    if (s.dirty) return;
+    s.dirty = true;
+    dirty.push_back(slot);
+  }
+
+  // Collapses the shape's triangles to a point, which draws nothing.
+  void hide(uint32_t slot) {
+    const Slot& s = slots[slot];
+    for (uint32_t i = s.first; i < s.first + s.count; i++) vertices[i].position = sf::Vector2f();
+    touch(slot);
+  }
+
+  void setColor(uint32_t slot, sf::Color color) {
+    const Slot& s = slots[slot];
+    for (uint32_t i = s.first; i < s.first + s.count; i++) vertices[i].color = color;
+    touch(slot);
+  }
+
+  void clear() {
+    local.clear();
+    vertices.clear();
+    slots.clear();
+    freeSlots.clear();
+    dirty.clear();
+    resized = true;
+    changes++;
+  }
+
+  size_t vertexCount() const { return vertices.size(); }
+  size_t lastUpload() const { return uploaded; } // vertices, in the last draw()
+  uint64_t revision() const { return changes; }  // goes up with every touch()
+
+  void draw(sf::RenderTarget& target) {
+    uploaded = 0;
+    if (!sf::VertexBuffer::isAvailable()) {
+      for (uint32_t slot : dirty) slots[slot].dirty = false;
+      dirty.clear();
+      if (!vertices.empty()) target.draw(vertices.data(), vertices.size(), sf::Triangles);
+      return;
+    }
+
+    if (!buffer) {
+      buffer.reset(new sf::VertexBuffer(sf::Triangles, usage));
+      resized = true;
+    }
+    if (resized) {
+      buffer->create(vertices.size());
+      if (!vertices.empty()) buffer->update(vertices.data());
+      uploaded = vertices.size();
+      resized = false;
+      for (uint32_t slot : dirty) slots[slot].dirty = false;
+      dirty.clear();
+    }
+
+    std::sort(dirty.begin(), dirty.end()); // slots are in vertex order
+    for (size_t i = 0; i < dirty.size();) {
+      uint32_t begin = slots[dirty[i]].first;
+      uint32_t end = begin + slots[dirty[i]].count;
+      slots[dirty[i++]].dirty = false;
+      while (i < dirty.size() && slots[dirty[i]].first <= end + mergeGap) {
+        end = slots[dirty[i]].first + slots[dirty[i]].count;
+        slots[dirty[i++]].dirty = false;
+      }
+      buffer->update(&vertices[begin], end - begin, begin);
+      uploaded += end - begin;
+    }
+    dirty.clear();
+
+    if (!vertices.empty()) target.draw(*buffer);
+  }
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <Box2D/Box2D.h>
+
+// The state of every moving body in a world, taken and put back without
+// creating or destroying anything, so that restoring is cheap enough to do
+// every frame while scrubbing.
+//
+//   WorldSnapshot s;
+//   s.capture(world);
+//   ...
+//   s.restore(world); // same bodies, as they were
+//
+// A snapshot holds body pointers, so it is only valid for the set of bodies
+// it was taken from; whoever creates, destroys, enables or disables bodies
+// has to drop the snapshots (see epoch). Static bodies never move and are
+// left out.
+//
+// Warm-start impulses are kept for every touching contact. On restore they
+// go back into those of the contacts that exist again, matched by fixtures
+// and feature id, and Box2D carries them into the next step's manifolds.
+// Contacts that don't exist at that moment start cold, as Box2D's would.
+class WorldSnapshot
+{
+public:
+  struct BodyState
+  {
+    b2Body* body;
+    b2Vec2 p;
+    float angle;
+    b2Vec2 v;
+    float w;
+    bool awake;
+  };
+
+  struct ContactState
+  {
+    b2Fixture* a;
+    b2Fixture* b;
+    int32 childA, childB;
+    int32 pointCount;
+    uint32 id[b2_maxManifoldPoints];
+    float normalImpulse[b2_maxManifoldPoints];
+    float tangentImpulse[b2_maxManifoldPoints];
+
+    bool operator<(const ContactState& o) const {
+      if (a != o.a) return a < o.a;
+      if (b != o.b) return b < o.b;
+      if (childA != o.childA) return childA < o.childA;
+      return childB < o.childB;
+    }
+  };
+
+  std::vector<BodyState> bodies;
+  std::vector<ContactState> contacts; // sorted
+  uint64_t step = 0;
+  int epoch = 0;
+
+  void capture(b2World& world) {
+    bodies.clear();
+    for (b2Body* b = world.GetBodyList(); b; b = b->GetNext()) {
+      if (b->GetType() == b2_staticBody || !b->IsEnabled()) continue;
+      bodies.push_back({ b, b->GetPosition(), b->GetAngle(), b->GetLinearVelocity(),
+        b->GetAngularVelocity(), b->IsAwake() });
+    }
+
+    contacts.clear();
+    for (b2Contact* c = world.GetContactList(); c; c = c->GetNext()) {
+      const b2Manifold* m = c->GetManifold();
+      if (!c->IsTouching() || m->pointCount == 0) continue;
+      ContactState s;
+      s.a = c->GetFixtureA();
+      s.b = c->GetFixtureB();
+      s.childA = c->GetChildIndexA();
+      s.childB = c->GetChildIndexB();
+      s.pointCount = m->pointCount;
+      for (int32 i = 0; i < m->pointCount; i++) {
+        s.id[i] = m->points[i].id.key;
+        s.normalImpulse[i] = m->points[i].normalImpulse;
+        s.tangentImpulse[i] = m->points[i].tangentImpulse;
+      }
+      contacts.push_back(s);
+    }
+    std::sort(contacts.begin(), contacts.end());
+  }
+
+  void restore(b2World& world) const {
+    for (const BodyState& s : bodies) {
+      b2Body* b = s.body;
+      if (!(b->GetPosition() == s.p) || b->GetAngle() != s.angle)
+        b->SetTransform(s.p, s.angle); // moves the broadphase proxies, so only when needed
+      if (s.awake) {
+        b->SetAwake(true);
+        b->SetLinearVelocity(s.v);
+        b->SetAngularVelocity(s.w);
+      } else {
+        b->SetAwake(false); // also zeroes the velocities, which is what a sleeping body has
+      }
+    }
+
+    if (contacts.empty()) return;
+    for (b2Contact* c = world.GetContactList(); c; c = c->GetNext()) {
+      b2Manifold* m = c->GetManifold();
+      ContactState key;
+      key.a = c->GetFixtureA();
+      key.b = c->GetFixtureB();
+      key.childA = c->GetChildIndexA();
+      key.childB = c->GetChildIndexB();
+      auto it = std::lower_bound(contacts.begin(), contacts.end(), key);
+      bool found = it != contacts.end() && !(key < *it);
+      for (int32 i = 0; i < m->pointCount; i++) {
+        m->points[i].normalImpulse = 0;
+        m->points[i].tangentImpulse = 0;
+        if (!found) continue;
+        for (int32 j = 0; j < it->pointCount; j++) {
+          if (it->id[j] == m->points[i].id.key) {
+            m->points[i].normalImpulse = it->normalImpulse[j];
+            m->points[i].tangentImpulse = it->tangentImpulse[j];
+          }
+        }
+      }
+    }
+  }
+
+  size_t bytes() const {
+    return bodies.size() * sizeof(BodyState) + contacts.size() * sizeof(ContactState);
+  }
+};
+
+// The last capacity snapshots, oldest first. Slots are reused, so once the
+// ring is full, taking a snapshot allocates nothing.
+class RewindRing
+{
+  std::vector<WorldSnapshot> slots;
+  size_t first = 0;
+  size_t count = 0;
+
+public:
+  explicit RewindRing(size_t capacity = 1) : slots(std::max<size_t>(capacity, 1)) {}
+
+  size_t size() const { return count; }
+  size_t capacity() const { return slots.size(); }
+
+  void clear() { first = count = 0; }
+
+  // The slot for a new newest snapshot, dropping the oldest if full.
+  WorldSnapshot& push() {
+    if (count == slots.size()) first = (first + 1) % slots.size();
+    else count++;
+    return slots[(first + count - 1) % slots.size()];
+  }
+
+  // 0 is the oldest.
+  const WorldSnapshot& at(size_t i) const { return slots[(first + i) % slots.size()]; }
+
+  // Forgets everything newer than at(n - 1), after rewinding to it.
+  void truncate(size_t n) { count = std::min(count, n); }
+
+  size_t bytes() const {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) n += at(i).bytes();
+    return n;
+  }
+};
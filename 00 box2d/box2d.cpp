@@ -2,126 +2,327 @@
 #include "imgui-SFML.h" // for ImGui::SFML::* functions and SFML-specific overloads
 
 
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <random>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #include <Box2D/Box2D.h>
 #include <SFML/Graphics.hpp>
 
+#include "Character.hpp"
+#include "DebugDraw.hpp"
+#include "Ecs.hpp"
+#include "Fluid.hpp"
+#include "InputSampler.hpp"
+#include "Level.hpp"
+#include "PhysicsThread.hpp"
+#include "Platformer.hpp"
+#include "Profiler.hpp"
+#include "Replay.hpp"
+#include "ResourceCache.hpp"
+#include "ShapeBatch.hpp"
+#include "Snapshot.hpp"
+
 #define DEGTORAD 0.0174532925199432957f
 #define RADTODEG 57.295779513082320876f
 
 const int W = 1024;
 const int H = 768;
 
-const float PPM = 32.0f;
-
-b2Vec2 gravity(0.0f, 0.3f);
-b2World world(gravity);
-bool paused = false;
+// Replaced by a fresh one when a replay is recorded or played, since only a
+// world built from nothing in the same order steps the same way.
+std::unique_ptr<b2World> world(new b2World(b2Vec2(0.0f, Tuning().gravity)));
 
 using namespace sf;
 
-struct Entity
-{
-    const char* name;
-    float width, height;
-    float xinit, yinit;
-
-    b2BodyDef def;
-    b2PolygonShape shape;
-    b2FixtureDef fixtureDef;
-    b2Body* body;
-
-    RectangleShape sfShape;
-
-    Entity(const char* _name, float _width, float _height, float _xinit, float _yinit, Color color) {
-        name = _name;
-        width = _width; height = _height;
-        xinit = _xinit; yinit = _yinit;
-
-        def.userData.pointer = reinterpret_cast<uintptr_t>(this);
-        def.position.Set(xinit / PPM, yinit / PPM);
-        shape.SetAsBox(width * .5f / PPM, height * .5f / PPM);
-        //shape.SetAsBox(1.05f * width * .5f / PPM, height * .5f / PPM);
-        // 1.05 factor because testing platforms showed it was needed
-        fixtureDef.shape = &shape;
-
-        sfShape.setSize(Vector2f(width, height));
-        sfShape.setOrigin(width * .5f, height * .5f);
-        sfShape.setFillColor(color);
-        sfShape.setPosition(xinit, yinit);
+// Components. Everything has a Body and a Visual; scene entities also
+// have a Name. The ones that move also carry Dynamic.
+struct Body { b2Body* body; };
+struct Visual { ShapeBatch* batch; uint32_t slot; }; // staticShapes or movingShapes
+struct Name { const char* name; };
+struct Dynamic {}; // wraps at the screen edges and is synced while awake
+struct Previous {  // transform before the last step, for interpolation
+    b2Vec2 p;
+    float angle;
+    uint64_t asleepSince; // number of the first frame captured asleep, 0 while awake
+};
+
+Registry registry;
+
+// The player and the bots; also the world's contact listener.
+Characters characters;
+
+// Shapes that never move are placed once, when created; everything else is
+// re-placed by the sync stage while its body is awake.
+ShapeBatch staticShapes(VertexBuffer::Static);
+ShapeBatch movingShapes;
+
+// Bumped whenever bodies are created, destroyed, enabled or disabled.
+// World snapshots from an older epoch no longer apply.
+int bodySetEpoch = 0;
+
+// userData holds the entity's slot + 1, so 0 still means "none".
+EntityId entityOf(b2Body* body) {
+    uintptr_t p = body->GetUserData().pointer;
+    return p ? registry.at(uint32_t(p - 1)) : noEntity;
+}
+
+EntityId spawn(const char* name, Recipe r, float width, float height, Color color) {
+    bool moving = r.def.type != b2_staticBody;
+    ShapeBatch& batch = moving ? movingShapes : staticShapes;
+    Visual visual{ &batch, batch.add(Vector2f(width, height), false, color) };
+    batch.place(visual.slot, Vector2f(r.xinit, r.yinit), r.def.angle);
+
+    b2Body* body = r.build(*world);
+    bodySetEpoch++;
+    EntityId e = moving ?
+        registry.create(Body{ body }, visual, Name{ name }, r, Dynamic(), Previous{ body->GetPosition(), body->GetAngle(), 0 }) :
+        registry.create(Body{ body }, visual, Name{ name }, r);
+    body->GetUserData().pointer = uintptr_t(e.index) + 1;
+    return e;
+}
+
+void despawn(EntityId e) {
+    Visual& v = registry.get<Visual>(e);
+    v.batch->remove(v.slot);
+    world->DestroyBody(registry.get<Body>(e).body);
+    registry.destroy(e);
+    bodySetEpoch++;
+}
+
+// Crowds of boxes and circles, for finding the body count at which a step
+// costs more than the physics budget. Bodies come from a pool: clear()
+// disables them, which takes them out of the broadphase, and hides their
+// shapes; the next spawn() enables them again instead of building new ones.
+class Stress {
+public:
+    std::vector<EntityId> active, idle;
+    int burst = 500;
+    float circles = 0.5f; // share of new bodies that are round
+    float size = W / 80;
+
+    void spawn(int n) {
+        bodySetEpoch++;
+        for (int i = 0; i < n; i++) {
+            EntityId e;
+            if (idle.empty()) {
+                e = create(rand() % 1000 < circles * 1000);
+            }
+            else {
+                e = idle.back();
+                idle.pop_back();
+            }
+            b2Body* body = registry.get<Body>(e).body;
+            b2Vec2 p((rand() % W) / PPM, -(rand() % (H / 2)) / PPM);
+            body->SetTransform(p, rand() % 360 * DEGTORAD);
+            body->SetLinearVelocity(b2Vec2((rand() % 200 - 100) / 100.0f, 0));
+            body->SetAngularVelocity(0);
+            body->SetEnabled(true);
+            body->SetAwake(true);
+            registry.get<Previous>(e) = Previous{ p, body->GetAngle(), 0 };
+            registry.add<Dynamic>(e);
+            active.push_back(e);
+        }
     }
 
+    void clear() {
+        bodySetEpoch++;
+        for (EntityId e : active) {
+            registry.get<Body>(e).body->SetEnabled(false);
+            movingShapes.hide(registry.get<Visual>(e).slot);
+            registry.remove<Dynamic>(e);
+            idle.push_back(e);
+        }
+        active.clear();
+    }
 
-    virtual void build() {
-        body = world.CreateBody(&def);
-        body->CreateFixture(&fixtureDef);
+    // Destroys the pool too, for building the world anew.
+    void reset() {
+        for (EntityId e : active) despawn(e);
+        for (EntityId e : idle) despawn(e);
+        active.clear();
+        idle.clear();
     }
 
-    Entity* next;
-};
+private:
+    EntityId create(bool round) {
+        b2BodyDef def;
+        def.type = b2_dynamicBody;
+        def.enabled = false;
+        b2Body* body = world->CreateBody(&def);
+
+        b2PolygonShape box;
+        b2CircleShape circle;
+        float half = size * .5f / PPM;
+        box.SetAsBox(half, half);
+        circle.m_radius = half;
+
+        b2FixtureDef fixtureDef;
+        fixtureDef.shape = round ? static_cast<b2Shape*>(&circle) : &box;
+        fixtureDef.density = 1.0f;
+        fixtureDef.friction = 0.3f;
+        fixtureDef.restitution = 0.1f;
+        setKind(fixtureDef, Kind::Box);
+        body->CreateFixture(&fixtureDef);
 
-struct EntityList {
+        Color color(100 + rand() % 156, 100 + rand() % 156, 100 + rand() % 156);
+        Visual visual{ &movingShapes, movingShapes.add(Vector2f(size, size), round, color) };
+        EntityId e = registry.create(Body{ body }, visual, Previous());
+        body->GetUserData().pointer = uintptr_t(e.index) + 1;
+        return e;
+    }
+};
 
-    Entity* head;
-    Entity* tail;
-    EntityList& add(Entity* node) {
-        if (head == 0) {
-            head = tail = node;
+// The bodies of the current level, built from its compiled file (or from
+// the text source when there is none) and rebuilt whenever that file
+// changes. Static Scenery tiles all become fixtures of one body (see
+// buildScenery) and are placed once in the static shape batch, so a level of
+// thousands of tiles costs one body and nothing per frame.
+class Level
+{
+public:
+    std::string path;
+    std::string error;
+    unsigned seed = 1;  // of the dynamic bodies' angles
+    uint64_t hash = 0;  // of the level's bytes, see levelHash
+    std::vector<EntityId> entities;
+    b2Body* scenery = nullptr;
+    std::vector<uint32_t> tileSlots; // in staticShapes
+    int tiles = 0;
+    float loadMs = 0;
+
+    // Replaces the current level. On failure the current one stays.
+    bool load(const std::string& file) {
+        PROFILE_ZONE("load level");
+        Clock clock;
+        path = file;
+        modified = modifiedTime(file);
+
+        MappedFile mapped;
+        std::vector<uint8_t> compiled;
+        const uint8_t* data;
+        size_t size;
+        if (file.size() > 4 && file.compare(file.size() - 4, 4, ".txt") == 0) {
+            std::ifstream in(file);
+            if (!in || !compileLevel(in, compiled, error)) {
+                error = file + ": " + (in ? error : "can't read");
+                return false;
+            }
+            data = compiled.data();
+            size = compiled.size();
         }
         else {
-            tail->next = node;
-            tail = node;
+            if (!mapped.open(file)) {
+                error = file + ": can't map";
+                return false;
+            }
+            data = mapped.data();
+            size = mapped.size();
         }
-        node->next = 0;
-        return *this;
-    }
 
-    void draw(RenderWindow& window) {
-        for (Entity* e = head; e != 0; e = e->next) {
-            window.draw(e->sfShape);
+        LevelView level;
+        if (!level.open(data, size)) {
+            error = file + ": not a level";
+            return false;
         }
+        unload();
+        hash = levelHash(level);
+        build(level);
+        loadMs = clock.getElapsedTime().asSeconds() * 1000;
+        return true;
     }
-};
 
-struct DynamicEntity : Entity {
+    void unload() {
+        bodySetEpoch++;
+        for (EntityId e : entities)
+            despawn(e);
+        entities.clear();
+        if (scenery) world->DestroyBody(scenery);
+        scenery = nullptr;
+        for (uint32_t slot : tileSlots)
+            staticShapes.remove(slot);
+        tileSlots.clear();
+        tiles = 0;
+    }
 
-    float density, friction;
+    // Whether the file has changed since it was loaded. Looks at most
+    // twice a second.
+    bool changed() {
+        if (checkClock.getElapsedTime() < seconds(0.5f)) return false;
+        checkClock.restart();
+        return modifiedTime(path) != modified;
+    }
 
-    DynamicEntity(const char* _name, float _width, float _height, float _xinit, float _yinit,
-                  float _density, float _friction, Color color) :
-        Entity(_name, _width, _height, _xinit, _yinit, color)
-    {
-        density = _density; friction = _friction;
-        def.type = b2_dynamicBody;
-        def.angle = rand() % 360 * DEGTORAD;
+private:
+    std::vector<char> names; // Name components point in here
+    time_t modified = 0;
+    Clock checkClock;
 
-        shape.SetAsBox(width * .5f / PPM, height * .5f / PPM);
+    static time_t modifiedTime(const std::string& file) {
+        struct stat st;
+        return stat(file.c_str(), &st) == 0 ? st.st_mtime : 0;
+    }
+
+    void build(const LevelView& level) {
+        bodySetEpoch++;
+        const LevelBody* bodies = level.bodies();
+        const LevelFixture* fixtures = level.fixtures();
+        const LevelVisual* visuals = level.visuals();
+        names.assign(level.names(), level.names() + level.namesSize());
+        scenery = buildScenery(*world, level);
+        std::minstd_rand rng(seed);
+
+        for (uint32_t i = 0; i < level.count(); i++) {
+            const LevelBody& b = bodies[i];
+            const LevelFixture& f = fixtures[i];
+            const LevelVisual& v = visuals[i];
+            Color color(v.color);
+
+            if (isScenery(b)) {
+                uint32_t slot = staticShapes.add(Vector2f(v.width, v.height), false, color);
+                staticShapes.place(slot, Vector2f(b.x, b.y), 0);
+                tileSlots.push_back(slot);
+                tiles++;
+                continue;
+            }
 
-        fixtureDef.density = density;
-        fixtureDef.friction = friction;
+            Recipe r = levelRecipe(b, f);
+            randomizeAngle(r, rng);
+            entities.push_back(spawn(names.data() + v.name, r, v.width, v.height, color));
+        }
     }
+};
+
+// The last few seconds of one statistic, for ImGui::PlotLines.
+struct History
+{
+    static const int size = 240;
+    float values[size] = {};
+    int next = 0;
 
-    void build() {
-        Entity::build();
-        sfShape.setRotation(body->GetAngle() * RADTODEG);
+    void push(float v) {
+        values[next] = v;
+        next = (next + 1) % size;
     }
 
-    void update() {
-        if (body->GetPosition().x >= W / PPM)
-            body->SetTransform(b2Vec2(0.0f, body->GetPosition().y), body->GetAngle());
-        if (body->GetPosition().x < 0)
-            body->SetTransform(b2Vec2(W / PPM, body->GetPosition().y), body->GetAngle());
+    float last() const { return values[(next + size - 1) % size]; }
 
-        sfShape.setRotation(body->GetAngle() * RADTODEG);
-        sfShape.setPosition(body->GetPosition().x * PPM, body->GetPosition().y * PPM);
+    float average(int n) const {
+        float sum = 0;
+        for (int i = 1; i <= n; i++) sum += values[(next + size - i) % size];
+        return sum / n;
     }
 
-    void recreate() {
-        body->DestroyFixture(body->GetFixtureList());
-        world.DestroyBody(body);
-        def.position.Set(xinit / PPM, yinit / PPM);
-        def.angle = rand() % 360 * DEGTORAD;
-        body = world.CreateBody(&def);
-        body->CreateFixture(&fixtureDef);
+    void plot(const char* label, const char* format, float scaleMax = FLT_MAX) const {
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), format, last());
+        ImGui::PlotLines(label, values, size, next, overlay, 0.0f, scaleMax, ImVec2(0, 40));
     }
 };
 
@@ -131,35 +332,75 @@ public:
     const static int hNum = H / space;
     const static int wNum = W / space;
 
-    RectangleShape hLines[hNum + 1];
-    RectangleShape wLines[wNum + 1];
+    VertexArray lines{ Quads }; // one draw for the whole grid
 
     bool isVisible = false;
 
     Grid() {
         for (int i = 0; i <= hNum; i++) {
-            hLines[i].setSize(Vector2f(W, 1));
-            hLines[i].setPosition(0, space * i);
+            float y = i == hNum ? H - 1 : float(space * i);
+            rect(0, y, W, 1);
         }
-        hLines[hNum].setPosition(0, H - 1);
-
         for (int i = 0; i <= wNum; i++) {
-            wLines[i].setSize(Vector2f(1, H));
-            wLines[i].setPosition(space * i, 0);
+            float x = i == wNum ? W - 1 : float(space * i);
+            rect(x, 0, 1, H);
         }
-        wLines[wNum].setPosition(W - 1, 0);
     }
 
-    void draw(RenderWindow& window) {
+    void rect(float x, float y, float w, float h) {
+        lines.append(Vertex(Vector2f(x, y)));
+        lines.append(Vertex(Vector2f(x + w, y)));
+        lines.append(Vertex(Vector2f(x + w, y + h)));
+        lines.append(Vertex(Vector2f(x, y + h)));
+    }
+
+    void draw(RenderTarget& target) {
         if (isVisible) {
-            for (int i = 0; i <= hNum; i++) {
-                window.draw(hLines[i]);
-            }
-            for (int i = 0; i <= wNum; i++) {
-                window.draw(wLines[i]);
-            }
+            target.draw(lines);
+        }
+    }
+};
+
+// Content that hardly ever changes, drawn once into a texture and then put
+// on screen with a single sprite draw. It is drawn again when the key
+// passed to draw() changes, when the target's size does or after
+// invalidate(). The sprite replaces what is under it, alpha and all,
+// which is right for the bottom layer of a freshly cleared frame and keeps
+// antialiased edges from being blended twice.
+class CachedLayer {
+public:
+    int bakes = 0;
+    int bakedCalls = 0; // draw calls the content took when last drawn directly
+
+    void invalidate() { valid = false; }
+
+    // paint(target) draws the content and returns how many draw calls that took.
+    template <typename Paint>
+    void draw(RenderTarget& target, uint64_t key, Paint paint) {
+        Vector2u size = target.getSize();
+        if (!valid || key != lastKey || size != texture.getSize()) {
+            PROFILE_ZONE("bake layer");
+            if (size != texture.getSize()) texture.create(size.x, size.y);
+            texture.setView(target.getView());
+            texture.clear(Color::Transparent);
+            bakedCalls = paint(texture);
+            texture.display();
+            sprite.setTexture(texture.getTexture(), true);
+            lastKey = key;
+            valid = true;
+            bakes++;
         }
+        View view = target.getView();
+        target.setView(target.getDefaultView());
+        target.draw(sprite, RenderStates(BlendNone));
+        target.setView(view);
     }
+
+private:
+    RenderTexture texture;
+    Sprite sprite;
+    uint64_t lastKey = 0;
+    bool valid = false;
 };
 
 struct MyText {
@@ -172,7 +413,8 @@ struct HelpTexts {
     Font& font;
     MyText* head;
     MyText* tail;
-    HelpTexts(Font& myFont) : font(myFont) { }
+    int count = 0;
+    HelpTexts(Font& myFont) : font(myFont), head(0), tail(0) { }
 
     HelpTexts& add(const char* s, float x, float y, float size = 18.0f, Color color = Color::Blue) {
         Text* t = new Text(s, font, size);
@@ -188,351 +430,800 @@ struct HelpTexts {
             tail = myText;
         }
         myText->next = 0;
+        count++;
 
         return *this;
     }
-    void draw(RenderWindow& window) {
+    void draw(RenderTarget& target) {
         for (MyText* t = head; t != 0; t = t->next) {
-            window.draw(*t->text);
+            target.draw(*t->text);
         }
     }
 };
 
-struct Player : public b2ContactListener{
-
-    DynamicEntity entity;
-    b2Body* body;
-    RectangleShape foot;
-
-    bool jumpButtomPressed, jumpButtomReleased;
-    int jumpCount = 0;
-
-    Player() : entity("player", W / 40, W / 40, W / 10, 0.0f, 0.3f, 0.3f, Color::Green) {
-        
-        //entity.fixtureDef.friction = 0.0f;
-        entity.fixtureDef.restitution = 0.3f;
-
-        entity.build();
-        body = entity.body;
-        
-        // // Foot Sensor
-        // float footWidth = entity.width * .5f;
-        // float footHeight = entity.height * .5f;
-        // entity.shape.SetAsBox(footWidth*.5f / PPM, footHeight*.5f / PPM, b2Vec2(0, -footHeight/PPM), 0);
-        // entity.fixtureDef.isSensor = true;
-        // entity.fixtureDef.userData.pointer = reinterpret_cast<uintptr_t>(this);
-        // b2Fixture* footSensor = body->CreateFixture(&entity.fixtureDef);
-
-        // foot.setSize(Vector2f(footWidth, footHeight));
-        // foot.setOrigin(footWidth/2, footHeight);
-        // foot.setFillColor(Color::Red);
-        // foot.setPosition(entity.xinit, entity.yinit);
-    }
-    void keyboardJump() {
-        if (jumpCount < 2) {
-            b2Vec2 vel = body->GetLinearVelocity(); vel.y = -1.35;
-            body->SetLinearVelocity(vel);
-            jumpCount++;
-            entity.fixtureDef.friction = 0.0f;
-        }
-    }
-    void moveRight() {
-        b2Vec2 vel = body->GetLinearVelocity(); vel.x = 0.3f;
-        body->SetLinearVelocity(vel);
-        body->SetAngularVelocity(20 * DEGTORAD);
+// The player is character 0: it is added first and bots only ever come and
+// go after it.
+struct Player {
 
-    }
-    void moveLeft() {
-        b2Vec2 vel = body->GetLinearVelocity(); vel.x = -0.3f;
-        body->SetLinearVelocity(vel);
-        body->SetAngularVelocity(-20 * DEGTORAD);
-    }
+    EntityId entity;
+    CircleShape foot; // the foot sensor, red while grounded
 
-    void update() {
+    Player() {
+        respawn();
+        foot.setFillColor(Color::Transparent);
+        foot.setOutlineThickness(1);
+    }
 
-        if (jx > 40) moveRight();
-        if (jx < -40) moveLeft();
+    Character& character() { return characters[0]; }
 
-        entity.update();
+    // A new body at the start, in the world as it is now, and no memory of
+    // the old one. Expects no characters left from the old world.
+    void respawn() {
+        const Tuning& t = characters.tuning;
+        entity = spawn("player", playerRecipe(t), t.playerSize, t.playerSize, Color::Green);
+        characters.add(registry.get<Body>(entity).body);
+    }
 
-        //foot.setRotation(body->GetAngle() * RADTODEG);
-        //foot.setPosition(body->GetPosition().x * PPM, body->GetPosition().y * PPM);        
+    // Under the physics mutex.
+    void update() {
+        const Character& c = character();
+        float r = c.foot->GetShape()->m_radius * PPM;
+        b2Vec2 p = c.body->GetPosition();
+        foot.setRadius(r);
+        foot.setOrigin(r, r);
+        foot.setPosition(p.x * PPM, p.y * PPM);
+        foot.setOutlineColor(c.grounded ? Color::Red : Color(255, 255, 255, 64));
     }
 
     void draw(RenderWindow& window) {
         window.draw(foot);
     }
 
-    void recreate() {
-        entity.recreate();
-    }
-
     const Joystick::Axis padAxisX = static_cast<Joystick::Axis>(0);
     const Joystick::Axis padAxisY = static_cast<Joystick::Axis>(1);
     const int padButtonA = 0;
-    int jx, jy;
-
-    void joystick(int id) {
-
-        jx = Joystick::getAxisPosition(id, padAxisX);
-        jy = Joystick::getAxisPosition(id, padAxisY);
+    int jx = 0, jy = 0;
 
-        if (Joystick::isButtonPressed(id, padButtonA)) {
-
-            entity.fixtureDef.friction = 0.3f;
-
-            if (jumpButtomReleased) {
-                if (jumpCount < 2) {
-                    body->SetLinearVelocity(b2Vec2(body->GetLinearVelocity().x, -1.35f));
-                    jumpCount++;
-                    jumpButtomReleased = false;
-                }
-            }
+    // One change from the InputSampler, applied in order. Nothing
+    // moves until the next step takes it with nextInput().
+    void input(const InputEvent& e) {
 
+        if (e.type == InputEvent::AxisMoved) {
+            if (e.axis == padAxisX) jx = int(e.position);
+            if (e.axis == padAxisY) jy = int(e.position);
+        }
+        else if (e.type == InputEvent::ButtonPressed && e.button == padButtonA) {
+            press(StepInput::PadA);
         }
-        else if (!Joystick::isButtonPressed(id, padButtonA)) {
-            jumpButtomReleased = true;
+        else if (e.type == InputEvent::ButtonReleased && e.button == padButtonA) {
+            release(StepInput::PadA);
+        }
+        else if (e.type == InputEvent::KeyPressed || e.type == InputEvent::KeyReleased) {
+            bool down = e.type == InputEvent::KeyPressed;
+            uint8_t button = e.key == Keyboard::W ? StepInput::Jump :
+                             e.key == Keyboard::A ? StepInput::Left :
+                             e.key == Keyboard::D ? StepInput::Right : 0;
+            if (down) press(button);
+            else release(button);
         }
     }
 
-    void BeginContact(b2Contact* contact) {
+    // The input for the step about to run. A button tapped between two
+    // steps still counts as held for one.
+    StepInput nextInput() {
+        StepInput in = { uint8_t(held | tapped), int8_t(std::max(-100, std::min(100, jx))),
+                         int8_t(std::max(-100, std::min(100, jy))), 0 };
+        tapped = 0;
+        return in;
+    }
 
-        // Check body contact with exit
-        Entity* exit = 0;
-        Entity* player = 0;
-        Entity* leftWall = 0;
-        Entity* rightWall = 0;
+private:
+    uint8_t held = 0, tapped = 0;
 
-        b2BodyUserData data = contact->GetFixtureA()->GetBody()->GetUserData();
-        if (data.pointer != 0) {
-            Entity* b = (Entity*)data.pointer;
-            if (strcmp(b->name, "player") == 0) {
-                player = b;
-            }
-            else if (strcmp(b->name, "exit") == 0) {
-                exit = b;
-            }
-            else if (strcmp(b->name, "leftWall") == 0) {
-                leftWall = b;
-            }
-            else if (strcmp(b->name, "rightWall") == 0) {
-                rightWall = b;
-            }
-
-        }
+    void press(uint8_t button) { held |= button; tapped |= button; }
+    void release(uint8_t button) { held &= ~button; }
+};
 
-        data = contact->GetFixtureB()->GetBody()->GetUserData();
-        if (data.pointer != 0) {
-            Entity* b = (Entity*)data.pointer;
-            if (strcmp(b->name, "player") == 0) {
-                player = b;
-            }
-            else if (strcmp(b->name, "exit") == 0) {
-                exit = b;
-            }
-            else if (strcmp(b->name, "leftWall") == 0) {
-                leftWall = b;
-            }
-            else if (strcmp(b->name, "rightWall") == 0) {
-                rightWall = b;
-            }            
-        }
-        if (exit && player) {
-            exit->sfShape.setFillColor(Color::Black);
+// A crowd of player-sized characters for load tests. Each runs one way for
+// a few seconds, then the other, and jumps every so often; its input only
+// depends on its index and the step, so the crowd costs no callbacks and
+// no lookups. Bots are characters 1 and up, removed from the end.
+class Bots {
+public:
+    std::vector<EntityId> entities;
+    int burst = 100;
+
+    void add(int n) {
+        const Tuning& t = characters.tuning;
+        for (int i = 0; i < n; i++) {
+            Recipe r = playerRecipe(t);
+            r.xinit = float(rand() % W);
+            r.yinit = -float(rand() % (H / 2));
+            r.def.position.Set(r.xinit / PPM, r.yinit / PPM);
+            EntityId e = spawn("bot", r, t.playerSize, t.playerSize, Color::Yellow);
+            characters.add(registry.get<Body>(e).body);
+            entities.push_back(e);
         }
+    }
 
-        if (player && leftWall) {
-            float impulse = body->GetMass();
-            body->ApplyLinearImpulse( b2Vec2(impulse, 0), body->GetWorldCenter(), true);      
-            moveRight();
-            body->ApplyLinearImpulse( b2Vec2(0, -impulse*0.01), body->GetWorldCenter(), true);
-            return;
+    void clear() {
+        while (!entities.empty()) {
+            characters.remove(characters.size() - 1);
+            despawn(entities.back());
+            entities.pop_back();
         }
-        if (player && rightWall) {
-            
-            float impulse = body->GetMass();
-            body->ApplyLinearImpulse( b2Vec2(-2*impulse, -impulse*0.01), body->GetWorldCenter(), true);             
-            //moveLeft();
-            return;
-        }
-        if (player) {
-            jumpCount = 0;
-        }
-
     }
 
-    void EndContact(b2Contact* contact) {
-        // Check foot sensor
+    // For when the characters have been cleared already.
+    void reset() {
+        for (EntityId e : entities) despawn(e);
+        entities.clear();
+    }
 
-    }    
+    // Fills inputs[1..] for the step numbered step.
+    void inputs(std::vector<StepInput>& out, uint64_t step) const {
+        for (size_t i = 0; i < entities.size(); i++) {
+            StepInput& in = out[i + 1];
+            in = StepInput();
+            in.held = (step / 400 + i) % 2 ? StepInput::Right : StepInput::Left;
+            if ((step + i * 37) % 90 < 3) in.held |= StepInput::Jump;
+        }
+    }
 };
 
 int main() {
-    srand(time(0));
+    // Seeds the level's body angles (and the stress bodies), so that a
+    // session can be built again; see the replays below.
+    unsigned seed = unsigned(time(0));
+    srand(seed);
     RenderWindow app(VideoMode(W, H, 32), "Box2D", Style::Titlebar);
     ImGui::SFML::Init(app);
     Grid grid;
-
-    float wallThickness = W / 80;
-    Entity leftWall("leftWall", wallThickness, H / 1.3f, 0.0f + wallThickness * .5f, H / 2, Color::White); leftWall.build();
-    Entity rightWall("rightWall", wallThickness, H / 1.3f, W - wallThickness * .5f, H / 2, Color::White); rightWall.build();
-    Entity ground("ground", W, wallThickness, W / 2, H - wallThickness * .5f, Color::White); ground.build();
-    Entity p1("p1", W / 10, wallThickness, 2*W/10, 9 * H / 10, Color::White); p1.build();
-    Entity p2("p2", W / 10, wallThickness, 4*W/10, 8 * H / 10, Color::White); p2.build();
-    Entity p3("p3", W / 10, wallThickness, 6*W/10, 7 * H / 10, Color::White); p3.build();
-    Entity exit("exit", W / 30, W / 20, 6*W/10, 6.4 * H / 10, Color::Green); exit.build();
+    CachedLayer staticLayer;
+
+    // The compiled level when pack.bat has made one, the source otherwise.
+    Level level;
+    level.seed = seed;
+    if (!level.load("level1.lvl") && !level.load("level1.txt")) {
+        printf("%s\n", level.error.c_str());
+        return 1;
+    }
 
     Player player;
-    world.SetContactListener(&player);
+    world->SetContactListener(&characters);
+
+    // The exit's body, if touched, goes with the old level.
+    auto reloadLevel = [&] {
+        if (!level.load(level.path))
+            printf("%s\n", level.error.c_str());
+        player.character().reachedExit = nullptr;
+    };
+
+    // Physics runs in fixed steps of stepper.dt on its own thread. Around
+    // every step, awake bodies remember where they were and wrap around the
+    // side edges; after the last step of a tick the awake ones' transforms
+    // are copied out for the renderer, which places their shapes between the
+    // last two steps without touching the world. Sleeping bodies are sent
+    // until the renderer has shown where they came to rest, then left out,
+    // so the render side's cost follows the bodies that move. Box2D's
+    // broadphase isn't thread safe, so only the read-only passes run on the
+    // pool. The step runs plain passes rather than Systems: a Systems flush
+    // could change the registry's structure under the render thread.
+    //
+    // The player's input is taken once per step, before it, so a session
+    // is its inputs by step index and replays the same. The bots' inputs
+    // follow from the step index.
+    ThreadPool pool;
+    PhysicsLoop physics;
+    physics.stepper.dt = 1 / characters.tuning.stepHz;
+
+    // Rewind: every 1/rewindRate s of simulated time the physics thread
+    // snapshots the world into a ring of the last few seconds. Holding
+    // [Backspace] or dragging the ImGui slider pauses and scrubs back
+    // through it; the next step continues from the moment shown and
+    // forgets the rest. [R] goes back to the state the world was in when
+    // its set of bodies last changed. All of it is guarded by the physics
+    // mutex.
+    const float rewindRate = 30;
+    RewindRing rewind(size_t(10 * rewindRate));
+    WorldSnapshot resetPoint;
+    resetPoint.epoch = -1;
+    float sinceSnapshot = 0;
+    uint64_t stepIndex = 0;
+    int scrub = -1; // ring index shown while rewinding, -1 when live
+    Bots bots;
+    std::vector<StepInput> inputs; // one per character, for the next step
+
+    // Water, stepped right after the world; see Fluid.hpp. Its particles
+    // stay on the screen or up to half a screen above it.
+    Fluid fluid(0, -H / 2 / PPM, W / PPM, H / PPM);
+    int pourCount = 2000;
+
+    // Replays: [F5] builds the world afresh and records the session, every
+    // step's input and the world's hash after it, until [F5] again saves
+    // it to replay.b2r. [F6] builds the same world and plays the file back
+    // through the same steps, checking every hash; replay.exe does that
+    // headless. Whatever a replay can't reproduce (rewinding, a level
+    // reload, stress bodies, water, other tuning or step rate) ends it.
+    enum ReplayMode { ReplayOff, Recording, Playing };
+    ReplayMode replayMode = ReplayOff;
+    Replay replay;
+    const char* replayPath = "replay.b2r";
+    int replayEpoch = 0;
+    size_t replayStep = 0;
+    std::string replayStatus;
+
+    auto endReplay = [&](const char* why) {
+        char status[128];
+        if (replayMode == Recording) {
+            bool saved = replay.save(replayPath);
+            snprintf(status, sizeof(status), saved ? "recorded %zu steps to %s" : "recorded %zu steps, can't write %s",
+                replay.steps.size(), replayPath);
+        }
+        else if (replayMode == Playing) {
+            snprintf(status, sizeof(status), why ? "played %zu of %zu steps" : "played %zu steps, all match",
+                replayStep, replay.steps.size());
+        }
+        else return;
+        replayStatus = status;
+        if (why) replayStatus = replayStatus + ": " + why;
+        replayMode = ReplayOff;
+    };
+
+    physics.step = [&] {
+        if (resetPoint.epoch != bodySetEpoch) {
+            resetPoint.capture(*world);
+            resetPoint.epoch = bodySetEpoch;
+            resetPoint.step = stepIndex;
+            rewind.clear();
+        }
+        if (scrub >= 0) {
+            rewind.truncate(size_t(scrub) + 1);
+            scrub = -1;
+        }
 
-    DynamicEntity redBox("redBox", W / 20, W / 20, W / 4, 0.0f, 1.0f, 0.1f, Color::Red); redBox.build();
-    DynamicEntity blueBox("blueBox", W / 20, W / 20, 3 * W / 4, 0.0f, 5.0f, 5.0f, Color::Blue); blueBox.build();
+        if (replayMode != ReplayOff && (bodySetEpoch != replayEpoch || physics.stepper.dt != replay.header.dt ||
+                memcmp(&characters.tuning, &replay.header.tuning, sizeof(Tuning)) != 0 || fluid.count() > 0))
+            endReplay("the world, the water, the tuning or the step rate changed");
+
+        registry.parallelEach<Body, Previous>(pool, [](EntityId, Body& b, Previous& prev) {
+            if (!b.body->IsAwake()) return;
+            prev.p = b.body->GetPosition();
+            prev.angle = b.body->GetAngle();
+        });
+
+        StepInput in = player.nextInput();
+        if (replayMode == Playing) in = replay.steps[replayStep].input;
+        inputs.resize(size_t(characters.size()));
+        inputs[0] = in;
+        bots.inputs(inputs, stepIndex);
+        platformerStep(*world, characters, inputs.data(), physics.stepper.dt, W, [](b2Body* b) {
+            EntityId e = entityOf(b);
+            if (registry.alive(e) && registry.has<Previous>(e))
+                registry.get<Previous>(e).p = b->GetPosition(); // a teleport, not motion to blend
+        }, &pool);
+        if (fluid.count()) {
+            PROFILE_ZONE("water");
+            fluid.step(*world, physics.stepper.dt, &pool);
+        }
 
-    EntityList entityList;
-    entityList.add(&leftWall).add(&rightWall).add(&ground).add(&p1).add(&p2).add(&p3).add(&exit);
-    entityList.add(&redBox).add(&blueBox).add(&player.entity);
+        if (replayMode == Recording) {
+            replay.steps.push_back({ in, 0, worldHash(*world) });
+        }
+        else if (replayMode == Playing) {
+            bool match = worldHash(*world) == replay.steps[replayStep].hash;
+            replayStep++;
+            if (!match) endReplay("diverged at the last one");
+            else if (replayStep == replay.steps.size()) endReplay(nullptr);
+        }
 
-    // for (Entity* e = entityList.head; e != 0; e = e->next) {
-    //     printf("e:%s | ", e->name);
-    // }
+        stepIndex++;
+        sinceSnapshot += physics.stepper.dt;
+        if (sinceSnapshot >= 1 / rewindRate) {
+            PROFILE_ZONE("snapshot");
+            sinceSnapshot = 0;
+            WorldSnapshot& snapshot = rewind.push();
+            snapshot.capture(*world);
+            snapshot.epoch = bodySetEpoch;
+            snapshot.step = stepIndex;
+        }
+    };
+
+    // Puts a snapshot back and shows it right away, even while paused.
+    auto restore = [&](const WorldSnapshot& snapshot) {
+        if (snapshot.epoch != bodySetEpoch) return false;
+        PROFILE_ZONE("restore");
+        endReplay("rewound");
+        snapshot.restore(*world);
+        registry.each<Body, Previous>([](EntityId, Body& b, Previous& prev) {
+            prev.p = b.body->GetPosition();
+            prev.angle = b.body->GetAngle();
+            prev.asleepSince = 0; // moved, even if asleep
+        });
+        stepIndex = snapshot.step;
+        physics.publish(physics.now());
+        return true;
+    };
+
+    // A body that has fallen asleep goes out unblended, exactly where it
+    // rests, in every frame until the renderer has applied one of them.
+    physics.capture = [&](TransformFrame& f) {
+        f.epoch = bodySetEpoch;
+        uint64_t consumed = physics.consumed;
+        registry.each<Body, Previous, Visual, Dynamic>([&](EntityId, Body& b, Previous& prev, Visual& v, Dynamic&) {
+            b2Vec2 p = b.body->GetPosition();
+            float angle = b.body->GetAngle();
+            if (b.body->IsAwake()) {
+                prev.asleepSince = 0;
+                f.push(v.slot, prev.p.x, prev.p.y, prev.angle, p.x, p.y, angle);
+                return;
+            }
+            if (!prev.asleepSince) prev.asleepSince = f.number;
+            if (prev.asleepSince > consumed)
+                f.push(v.slot, p.x, p.y, angle, p.x, p.y, angle);
+        });
+        fluid.publish();
+    };
+
+    // Places the shapes of the bodies in the newest frame and marks them
+    // for upload. A frame from before the set of bodies last changed may
+    // name slots that now belong to something else, so it is skipped, and
+    // not counted as consumed.
+    int synced = 0;
+    Systems frameSystems(registry, pool);
+    frameSystems.add("sync", [&] {
+        physics.frames.update();
+        const TransformFrame& f = physics.frames.readBuffer();
+        synced = 0;
+        if (f.epoch != bodySetEpoch) return;
+        float alpha = f.alpha(physics.now());
+        int chunks = int(f.size() + 255) / 256;
+        pool.parallelFor(chunks, [&](int c) {
+            size_t end = std::min(f.size(), size_t(c + 1) * 256);
+            for (size_t i = size_t(c) * 256; i < end; i++) {
+                float angle = f.pangle[i] + (f.angle[i] - f.pangle[i]) * alpha;
+                Vector2f position((f.px[i] + (f.x[i] - f.px[i]) * alpha) * PPM,
+                                  (f.py[i] + (f.y[i] - f.py[i]) * alpha) * PPM);
+                movingShapes.place(f.ids[i], position, angle);
+            }
+        });
+        for (uint32_t slot : f.ids)
+            movingShapes.touch(slot);
+        synced = int(f.size());
+        physics.consumed = f.number;
+    });
+
+    // The water as one batch of quads, one per particle, made again from
+    // every new frame; faster water is lighter.
+    VertexArray water(Quads);
+    frameSystems.add("water", [&] {
+        if (!fluid.frames.update()) return;
+        const FluidFrame& f = fluid.frames.readBuffer();
+        water.resize(f.x.size() * 4);
+        float r = 0.6f * fluid.particleSpacing() * PPM;
+        int chunks = int(f.x.size() + 1023) / 1024;
+        pool.parallelFor(chunks, [&](int c) {
+            size_t end = std::min(f.x.size(), size_t(c + 1) * 1024);
+            for (size_t i = size_t(c) * 1024; i < end; i++) {
+                float x = f.x[i] * PPM, y = f.y[i] * PPM, t = std::min(1.0f, f.speed[i] / 2);
+                Color color(Uint8(30 + 170 * t), Uint8(110 + 120 * t), Uint8(230 + 25 * t), 200);
+                Vertex* q = &water[i * 4];
+                q[0] = Vertex(Vector2f(x - r, y - r), color);
+                q[1] = Vertex(Vector2f(x + r, y - r), color);
+                q[2] = Vertex(Vector2f(x + r, y + r), color);
+                q[3] = Vertex(Vector2f(x - r, y + r), color);
+            }
+        });
+    });
 
     //text stuff to appear on the page
-    Font myFont;
-    if (!myFont.loadFromFile("sansation.ttf")) { return 1; }
+    AssetPack::mounted().open("box2d.pak"); // loose files when absent
+    auto fontResource = Resources::get().fonts.acquire("sansation.ttf");
+    if (!fontResource) { return 1; }
+    Font& myFont = *fontResource;
     HelpTexts helpTexts(myFont);
     helpTexts.add("[Escape] to exit", W / 32, H / 24);
     helpTexts.add("[WASD] to move square", W / 32, 2 * H / 24);
-    helpTexts.add("[P] - Pause   [O] - Single step", W / 32, 3 * H / 24);
+    helpTexts.add("[P] - Pause   [O] - Single step   [,] [.] - Step rate", W / 32, 3 * H / 24);
+    helpTexts.add("[F3] - Profiler   [F4] - Save trace.json", W / 32, 4 * H / 24);
+    helpTexts.add("[T] - Physics on its own thread / inline   [B] - Box2D debug draw", W / 32, 5 * H / 24);
+    helpTexts.add("[Backspace] - Rewind   [R] - Reset", W / 32, 6 * H / 24);
+    helpTexts.add("[F5] - Record replay / stop   [F6] - Play replay", W / 32, 7 * H / 24);
 
     HelpTexts pausedText(myFont);
     pausedText.add("PAUSED", W / 2, H / 2, 30, Color::Red);
 
-    float freq = 130.0f;
-    float oneStepFreq = 2000.0f;
-
-    float timeStep = 1 / freq;
-    int32 velocityIterations = 6;
-    int32 positionIterations = 2;
+    float freq = 1 / physics.stepper.dt;
 
     sf::Clock deltaClock;
     bool show_imgui_demo = true;
 
+    Stress stress;
+    float stepBudget = 2.0f; // ms of world->Step on the target machine
+    int overBudgetAt = 0;    // body count when the step first went over it
+    History stepTime, bodyCount, awakeCount, contactCount, proxyCount;
+
+    // [B] replaces the shapes with Box2D's own view of the world.
+    DebugDraw debugDraw(PPM);
+    world->SetDebugDraw(&debugDraw);
+    bool debugView = false;
+    bool debugContacts = false;
+    unsigned debugFlags = b2Draw::e_shapeBit;
+    bool physicsThread = true;
+
+    // Builds the world from nothing, in the order replay.exe does: the
+    // level (scenery first) with its angles from newSeed, then the player.
+    auto rebuildWorld = [&](unsigned newSeed) {
+        characters.clear();
+        bots.reset();
+        fluid.clear();
+        level.unload();
+        stress.reset();
+        despawn(player.entity);
+        world.reset(new b2World(b2Vec2(0, characters.tuning.gravity)));
+        world->SetContactListener(&characters);
+        world->SetDebugDraw(&debugDraw);
+        level.seed = newSeed;
+        bool ok = level.load(level.path);
+        player.respawn();
+        rewind.clear();
+        scrub = -1;
+        physics.publish(physics.now());
+        if (!ok) replayStatus = level.error;
+        return ok;
+    };
+
+    auto toggleRecording = [&] {
+        if (replayMode == Recording) {
+            endReplay(nullptr);
+            return;
+        }
+        endReplay("stopped");
+        seed = unsigned(time(0));
+        if (!rebuildWorld(seed)) return;
+        replay.begin(level.path, level.hash, seed, characters.tuning, physics.stepper.dt);
+        replayEpoch = bodySetEpoch;
+        replayMode = Recording;
+        replayStatus = "recording";
+    };
+
+    auto playReplay = [&] {
+        endReplay("stopped");
+        std::string error;
+        if (!replay.load(replayPath, error)) {
+            replayStatus = error;
+            return;
+        }
+        characters.tuning = replay.header.tuning;
+        physics.stepper.dt = replay.header.dt;
+        freq = 1 / physics.stepper.dt;
+        level.path = replay.header.level;
+        seed = replay.header.seed;
+        if (!rebuildWorld(seed)) return;
+        if (level.hash != replay.header.levelHash) {
+            replayStatus = level.path + " has changed since the recording";
+            return;
+        }
+        replayEpoch = bodySetEpoch;
+        replayStep = 0;
+        replayMode = replay.steps.empty() ? ReplayOff : Playing;
+        replayStatus = "playing";
+    };
+
+    // Joysticks are read on the sampler's thread, [WAD] from the window's
+    // events; see InputSampler.hpp.
+    InputSampler input({ Keyboard::W, Keyboard::A, Keyboard::D });
+    input.start(1000);
+
+    Profiler::get().setThreadName("main");
+    ProfilerOverlay overlay(myFont); // [F3] toggles, [F4] writes trace.json
+
+    physics.start();
+
     while (app.isOpen())
     {
-        world.Step(timeStep, velocityIterations, positionIterations);
+        if (!physics.threaded()) {
+            PROFILE_ZONE("step");
+            physics.tick();
+        }
 
-        Event e;
-        while (app.pollEvent(e)) {
+        {
+            PROFILE_ZONE("events");
+            std::lock_guard<std::mutex> lock(physics.mutex);
+            Event e;
+            while (input.pollEvent(app, e)) {
 
-            ImGui::SFML::ProcessEvent(app, e);
+                ImGui::SFML::ProcessEvent(app, e);
 
-            if (e.type == Event::Closed)
-                app.close();
+                if (e.type == Event::Closed)
+                    app.close();
 
-            if (e.type == Event::KeyPressed) {
+                if (e.type == Event::Resized)
+                    staticLayer.invalidate();
 
-                if (e.key.code == Keyboard::W) {
-                    player.keyboardJump();
-                }
+                if (e.type == Event::KeyPressed) {
 
-                if (e.key.code == Keyboard::R) {
-                    player.recreate();
-                }
+                    if (e.key.code == Keyboard::R && restore(resetPoint)) {
+                        rewind.clear();
+                        scrub = -1;
+                    }
 
-                if (e.key.code == Keyboard::Escape)
-                    app.close();
+                    if (e.key.code == Keyboard::Escape)
+                        app.close();
 
-                if (e.key.code == Keyboard::G)
-                    grid.isVisible = !grid.isVisible;
+                    if (e.key.code == Keyboard::F3) {
+                        overlay.visible = !overlay.visible;
+                        Profiler::get().enabled = overlay.visible;
+                    }
 
-                if (e.key.code == Keyboard::P) {
-                    paused = !paused;
-                    timeStep = paused ? 0.0f : 1 / freq;
-                }
+                    if (e.key.code == Keyboard::F4)
+                        Profiler::get().exportChromeTrace("trace.json");
+
+                    if (e.key.code == Keyboard::F5)
+                        toggleRecording();
+
+                    if (e.key.code == Keyboard::F6)
+                        playReplay();
+
+                    if (e.key.code == Keyboard::G)
+                        grid.isVisible = !grid.isVisible;
+
+                    if (e.key.code == Keyboard::B)
+                        debugView = !debugView;
+
+                    if (e.key.code == Keyboard::T)
+                        physicsThread = !physicsThread;
+
+                    if (e.key.code == Keyboard::P) {
+                        physics.stepper.togglePause();
+                    }
+
+                    if (e.key.code == Keyboard::O) {
+                        physics.stepper.singleStep();
+                    }
+                    if (e.key.code == Keyboard::Comma) {
+                        freq = std::max(30.0f, freq - 30);
+                        physics.stepper.dt = 1 / freq;
+                    }
+                    if (e.key.code == Keyboard::Period) {
+                        freq += 30;
+                        physics.stepper.dt = 1 / freq;
+                    }
 
-                if (e.key.code == Keyboard::O) {
-                    timeStep = 1 / oneStepFreq;
-                    paused = false;
-                }
-                if (e.key.code == Keyboard::Comma) {
-                    freq -= 30;
-                    timeStep = 1 / freq;
-                }
-                if (e.key.code == Keyboard::Period) {
-                    timeStep = 1 / freq;
-                    freq += 30;
                 }
+            } // pollEvent
 
-            }
-            if (e.type == Event::KeyReleased) {
-                if (e.key.code == Keyboard::O) {
-                    paused = true;
-                    timeStep = 0.0f;
+            if (app.hasFocus() && Keyboard::isKeyPressed(Keyboard::BackSpace) && rewind.size() > 0) {
+                int target = scrub < 0 ? int(rewind.size()) - 1 : std::max(0, scrub - 1);
+                if (restore(rewind.at(size_t(target)))) {
+                    physics.stepper.paused = true;
+                    scrub = target;
                 }
             }
 
-            if ((e.type == Event::JoystickButtonPressed) ||
-                (e.type == Event::JoystickButtonReleased) ||
-                (e.type == Event::JoystickMoved) ||
-                (e.type == Event::JoystickConnected)) {
+            // Joystick 0 and [WAD]. Key events only arrive while the window
+            // has focus.
+            InputEvent ie;
+            while (input.poll(ie)) {
+                bool isKey = ie.type == InputEvent::KeyPressed || ie.type == InputEvent::KeyReleased;
+                if (!isKey && ie.joystick != 0) continue;
+                player.input(ie);
+            }
 
-                // Update displayed joystick values
-                int id = e.joystickConnect.joystickId;
-                player.joystick(id);
+            Character& c = player.character();
+            if (c.reachedExit) {
+                Visual& exit = registry.get<Visual>(entityOf(c.reachedExit));
+                exit.batch->setColor(exit.slot, Color::Black);
+                c.reachedExit = nullptr;
             }
-        } // pollEvent
+            player.update();
 
-        if (Keyboard::isKeyPressed(sf::Keyboard::A)) {
-            player.moveLeft();
-        }
-        if (Keyboard::isKeyPressed(sf::Keyboard::D)) {
-            player.moveRight();
+            if (level.changed())
+                reloadLevel();
         }
 
-
-        ImGui::SFML::Update(app, deltaClock.restart());
-
-        if (show_imgui_demo)
-            ImGui::ShowDemoWindow(&show_imgui_demo);
         {
-            ImGui::Begin("myBox");
-            float f1 = 0.0f;
+            PROFILE_ZONE("imgui");
+            {
+                // Update reads the joysticks for gamepad navigation.
+                std::lock_guard<std::mutex> lock(input.devices);
+                ImGui::SFML::Update(app, deltaClock.restart());
+            }
 
-            //ImGui::LabelText("timeStep", "%.6f %.f", timeStep);
-            ImGui::SliderFloat("timeStep freq", &freq, 100.0f, 4000.0f, "%f");
-            ImGui::SliderFloat("oneStep freq", &oneStepFreq, 2000.0f, 4000.0f, "%f");
+            if (show_imgui_demo)
+                ImGui::ShowDemoWindow(&show_imgui_demo);
+            {
+                std::lock_guard<std::mutex> lock(physics.mutex);
+                ImGui::Begin("Physics");
+
+                if (ImGui::SliderFloat("step rate (Hz)", &freq, 30.0f, 1000.0f, "%.0f"))
+                    physics.stepper.dt = 1 / freq;
+                ImGui::SliderInt("max substeps", &physics.stepper.maxSubsteps, 1, 32);
+                ImGui::SliderFloat("time scale", &physics.stepper.timeScale, 0.1f, 4.0f, "%.2f");
+                ImGui::Checkbox("paused", &physics.stepper.paused);
+                ImGui::SameLine();
+                if (ImGui::Button("single step"))
+                    physics.stepper.singleStep();
+                ImGui::LabelText("steps", "%i last tick, %llu total", physics.stepper.lastSteps,
+                    (unsigned long long)physics.stepper.steps);
+                ImGui::Checkbox("physics thread", &physicsThread);
+                ImGui::LabelText("step cost", "%.3f ms", physics.stepMs.load());
+                ImGui::LabelText("dropped", "%.3f s", physics.stepper.droppedTime);
+
+                int enabled = world->GetBodyCount() - int(stress.idle.size());
+                int awake = 0;
+                for (b2Body* b = world->GetBodyList(); b; b = b->GetNext())
+                    awake += b->GetType() != b2_staticBody && b->IsAwake();
+                stepTime.push(world->GetProfile().step);
+                bodyCount.push(float(enabled));
+                awakeCount.push(float(awake));
+                contactCount.push(float(world->GetContactCount()));
+                proxyCount.push(float(world->GetProxyCount()));
+
+                if (rewind.size() > 0) {
+                    int shown = scrub < 0 ? int(rewind.size()) - 1 : scrub;
+                    float ago = (rewind.at(rewind.size() - 1).step - rewind.at(size_t(shown)).step) * physics.stepper.dt;
+                    char label[32];
+                    snprintf(label, sizeof(label), "-%.2f s", ago);
+                    if (ImGui::SliderInt("rewind", &shown, 0, int(rewind.size()) - 1, label) &&
+                        restore(rewind.at(size_t(shown)))) {
+                        physics.stepper.paused = true;
+                        scrub = shown;
+                    }
+                    ImGui::LabelText("history", "%.1f s, %.1f MB", rewind.size() / rewindRate,
+                        rewind.bytes() / (1024.0 * 1024.0));
+                }
 
-            b2Vec2 pos = player.body->GetPosition();
-            ImGui::LabelText("Position", "(%f, %f)", PPM * pos.x, PPM * pos.y);
+                if (ImGui::SliderFloat("gravity", &characters.tuning.gravity, 0.0f, 2.0f, "%.2f"))
+                    world->SetGravity(b2Vec2(0, characters.tuning.gravity));
+                ImGui::SliderFloat("jump speed", &characters.tuning.jumpSpeed, 0.5f, 4.0f, "%.2f");
+                ImGui::SliderFloat("run speed", &characters.tuning.runSpeed, 0.1f, 2.0f, "%.2f");
+                ImGui::SliderInt("jumps", &characters.tuning.maxJumps, 1, 4);
+
+                ImGui::LabelText("level", "%s: %i tiles, %i bodies, %.2f ms", level.path.c_str(),
+                    level.tiles, int(level.entities.size()), level.loadMs);
+                if (ImGui::Button("reload level"))
+                    reloadLevel();
+
+                if (ImGui::Button(replayMode == Recording ? "stop recording" : "record"))
+                    toggleRecording();
+                ImGui::SameLine();
+                if (ImGui::Button("play replay"))
+                    playReplay();
+                ImGui::SameLine();
+                if (replayMode == Playing)
+                    ImGui::Text("step %zu of %zu", replayStep, replay.steps.size());
+                else if (replayMode == Recording)
+                    ImGui::Text("%zu steps", replay.steps.size());
+                ImGui::LabelText("replay", "seed %u, %s", seed, replayStatus.c_str());
+
+                ImGui::Separator();
+                ImGui::SliderInt("burst", &stress.burst, 50, 5000);
+                ImGui::SliderFloat("circles", &stress.circles, 0.0f, 1.0f, "%.2f");
+                if (ImGui::Button("spawn"))
+                    stress.spawn(stress.burst);
+                ImGui::SameLine();
+                if (ImGui::Button("clear")) {
+                    stress.clear();
+                    overBudgetAt = 0;
+                }
+                ImGui::SameLine();
+                ImGui::Text("%i active, %i pooled", int(stress.active.size()), int(stress.idle.size()));
+
+                ImGui::SliderInt("bots", &bots.burst, 10, 1000);
+                if (ImGui::Button("add bots"))
+                    bots.add(bots.burst);
+                ImGui::SameLine();
+                if (ImGui::Button("clear bots"))
+                    bots.clear();
+                int grounded = 0;
+                for (int i = 0; i < characters.size(); i++) grounded += characters[i].grounded;
+                ImGui::SameLine();
+                ImGui::Text("%i characters, %i grounded", characters.size(), grounded);
+
+                ImGui::SliderInt("water", &pourCount, 100, 10000);
+                if (ImGui::Button("pour"))
+                    fluid.pour(pourCount, b2Vec2(float(W / 4 + rand() % (W / 2)) / PPM, H / 8 / PPM));
+                ImGui::SameLine();
+                if (ImGui::Button("drain"))
+                    fluid.clear();
+                ImGui::SameLine();
+                ImGui::Text("%i particles, %i contacts, %i substeps", fluid.count(), fluid.contacts, fluid.substeps);
+                ImGui::SliderFloat("water drag", &fluid.drag, 0.0f, 10.0f, "%.1f");
+                ImGui::SliderFloat("viscosity", &fluid.linearViscosity, 0.0f, 10.0f, "%.1f");
+
+                ImGui::SliderFloat("budget (ms)", &stepBudget, 0.5f, 8.0f, "%.1f");
+                if (!overBudgetAt && stepTime.average(30) > stepBudget)
+                    overBudgetAt = enabled;
+                if (overBudgetAt)
+                    ImGui::Text("over budget from %i bodies", overBudgetAt);
+                stepTime.plot("Step", "%.2f ms", 2 * stepBudget);
+                bodyCount.plot("bodies", "%.0f");
+                awakeCount.plot("awake", "%.0f");
+                contactCount.plot("contacts", "%.0f");
+                proxyCount.plot("proxies", "%.0f");
+                ImGui::Separator();
+
+                ImGui::Checkbox("debug draw", &debugView);
+                ImGui::CheckboxFlags("shapes", &debugFlags, b2Draw::e_shapeBit);
+                ImGui::SameLine();
+                ImGui::CheckboxFlags("joints", &debugFlags, b2Draw::e_jointBit);
+                ImGui::SameLine();
+                ImGui::CheckboxFlags("AABBs", &debugFlags, b2Draw::e_aabbBit);
+                ImGui::CheckboxFlags("pairs", &debugFlags, b2Draw::e_pairBit);
+                ImGui::SameLine();
+                ImGui::CheckboxFlags("centers of mass", &debugFlags, b2Draw::e_centerOfMassBit);
+                ImGui::SameLine();
+                ImGui::Checkbox("contacts", &debugContacts);
+                ImGui::LabelText("debug vertices", "%i", debugDraw.vertexCount());
+                ImGui::LabelText("static layer", "%i draw calls as 1, baked %i times",
+                    staticLayer.bakedCalls, staticLayer.bakes);
+                ImGui::LabelText("synced", "%i bodies, %i of %i vertices uploaded", synced,
+                    int(movingShapes.lastUpload()), int(movingShapes.vertexCount()));
+                ImGui::LabelText("Input latency", "%.2f ms avg, %.2f ms max",
+                    input.latencyAvg / 1000, input.latencyMax / 1000.0);
+
+                ImGui::End();
+            }
+        }
 
-            b2Vec2 lv = player.body->GetLinearVelocity();
-            ImGui::LabelText("LinearVelocity", "(%f, %f)", PPM * lv.x, PPM * lv.y);
-            float av = player.body->GetAngularVelocity();
-            ImGui::LabelText("AngularVelocity", "%f", PPM * av);
+        if (physicsThread != physics.threaded()) {
+            if (physicsThread) physics.start();
+            else physics.stop();
+        }
 
-            ImGui::LabelText("jumpCount", "%i", player.jumpCount);
+        app.clear();
 
-            ImGui::End();
+        {
+            PROFILE_ZONE("update");
+            frameSystems.run();
         }
-        app.clear();
 
-        player.update();
-        redBox.update();
-        blueBox.update();
+        {
+            PROFILE_ZONE("draw");
+            bool paused;
+            {
+                std::lock_guard<std::mutex> lock(physics.mutex);
+                paused = physics.stepper.paused;
+                if (debugView) {
+                    debugDraw.SetFlags(debugFlags);
+                    debugDraw.begin();
+                    world->DebugDraw();
+                    if (debugContacts) debugDraw.contactPoints(*world);
+                }
+            }
+            // The help, the grid and the static shapes only change with a
+            // toggle or a level change, so they come from the cache.
+            uint64_t key = staticShapes.revision() << 2 | uint64_t(debugView) << 1 | uint64_t(grid.isVisible);
+            staticLayer.draw(app, key, [&](RenderTarget& target) {
+                helpTexts.draw(target);
+                grid.draw(target);
+                if (!debugView) staticShapes.draw(target);
+                return helpTexts.count + int(grid.isVisible) + int(!debugView);
+            });
+            if (paused) {
+                pausedText.draw(app);
+            }
+            if (debugView) {
+                debugDraw.draw(app);
+            }
+            else {
+                movingShapes.draw(app);
+            }
+            if (water.getVertexCount() > 0)
+                app.draw(water);
+            player.draw(app);
 
-        if (paused) {
-            pausedText.draw(app);
+            overlay.draw(app, 0, H - 150, W);
+            ImGui::SFML::Render(app);
         }
-        helpTexts.draw(app);
-        entityList.draw(app);
-        player.draw(app);
 
-        grid.draw(app);
-        ImGui::SFML::Render(app);
         app.display();
+        Profiler::get().frameMark();
 
     } //app.isOpen()
 
+    physics.stop();
     ImGui::SFML::Shutdown();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,2 @@
+..\tools\levelc\levelc.exe level1.txt level1.lvl
+..\tools\packer\packer.exe box2d.pak sansation.ttf
\ No newline at end of file
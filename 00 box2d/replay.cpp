@@ -0,0 +1,132 @@
+// Headless replay check. Plays a session recorded in the game ([F5]) from a
+// fresh world, step by step, and compares the world's hash after every step
+// with the recorded one. Prints the first step that differs and exits with
+// 1, so it can drive git bisect run across physics changes.
+//
+//   replay <session.b2r> [level.lvl|level.txt] [--repeat 1]
+//
+// The level defaults to the path the session was recorded with, and has to
+// be the same level, byte for byte. --repeat plays the session that many
+// times, for timing.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Box2D/Box2D.h>
+
+#include "Character.hpp"
+#include "Level.hpp"
+#include "Platformer.hpp"
+#include "Replay.hpp"
+
+const float screenWidth = 1024; // px; the game's window, where bodies wrap around
+
+static bool readFile(const std::string& path, std::string& out)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+// The step at which the hashes first differ, or -1.
+static long play(const LevelView& level, const Replay& replay)
+{
+    const ReplayHeader& h = replay.header;
+    b2World world(b2Vec2(0, h.tuning.gravity));
+    std::minstd_rand rng(h.seed);
+
+    // The game's order: scenery, the level's other bodies, then the player.
+    buildScenery(world, level);
+    for (uint32_t i = 0; i < level.count(); i++) {
+        const LevelBody& b = level.bodies()[i];
+        if (isScenery(b)) continue;
+        Recipe r = levelRecipe(b, level.fixtures()[i]);
+        randomizeAngle(r, rng);
+        r.build(world);
+    }
+
+    Characters characters;
+    characters.tuning = h.tuning;
+    characters.add(playerRecipe(h.tuning).build(world));
+    world.SetContactListener(&characters);
+
+    for (size_t i = 0; i < replay.steps.size(); i++) {
+        const ReplayStep& s = replay.steps[i];
+        platformerStep(world, characters, &s.input, h.dt, screenWidth, [](b2Body*) {});
+        if (worldHash(world) != s.hash) return long(i);
+    }
+    return -1;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printf("usage: replay <session.b2r> [level.lvl|level.txt] [--repeat 1]\n");
+        return 2;
+    }
+    std::string levelPath;
+    int repeat = 1;
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "--repeat") && i + 1 < argc) repeat = std::max(1, atoi(argv[++i]));
+        else levelPath = argv[i];
+    }
+
+    Replay replay;
+    std::string error;
+    if (!replay.load(argv[1], error)) {
+        printf("replay: %s\n", error.c_str());
+        return 2;
+    }
+    if (levelPath.empty()) levelPath = replay.header.level;
+
+    std::string bytes;
+    std::vector<uint8_t> compiled;
+    if (!readFile(levelPath, bytes)) {
+        printf("replay: can't read %s\n", levelPath.c_str());
+        return 2;
+    }
+    const uint8_t* data = (const uint8_t*)bytes.data();
+    size_t size = bytes.size();
+    if (levelPath.size() > 4 && levelPath.compare(levelPath.size() - 4, 4, ".txt") == 0) {
+        std::istringstream text(bytes);
+        if (!compileLevel(text, compiled, error)) {
+            printf("replay: %s: %s\n", levelPath.c_str(), error.c_str());
+            return 2;
+        }
+        data = compiled.data();
+        size = compiled.size();
+    }
+    LevelView level;
+    if (!level.open(data, size)) {
+        printf("replay: %s: not a level\n", levelPath.c_str());
+        return 2;
+    }
+    if (levelHash(level) != replay.header.levelHash) {
+        printf("replay: %s isn't the level the session was recorded with\n", levelPath.c_str());
+        return 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    long diverged = -1;
+    for (int r = 0; r < repeat && diverged < 0; r++)
+        diverged = play(level, replay);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t steps = replay.steps.size();
+    if (diverged >= 0) {
+        printf("diverged at step %ld of %zu (%.3f s in)\n", diverged, steps, diverged * replay.header.dt);
+        return 1;
+    }
+    printf("%zu steps match, %.0f steps/s\n", steps, steps * repeat / std::max(seconds, 1e-9));
+    return 0;
+}
@@ -0,0 +1 @@
+cl.exe /EHsc /O2 /I..\box2d\include /I..\common /I.\ sweep.cpp /MDd /link /libpath:..\box2d\build\bin\Debug box2d.lib /out:sweep.exe
\ No newline at end of file
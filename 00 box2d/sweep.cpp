@@ -0,0 +1,338 @@
+// Headless parameter sweep for the platformer. Builds one world per tuning
+// from the same level, plays the same scripted input in each, spread over
+// every core, and writes what happened to CSV.
+//
+//   sweep <level.lvl|level.txt> <script.txt> <sweep.txt> <out.csv>
+//         [--arcs arcs.csv] [--time 30] [--threads 0] [--seed 1]
+//
+// script.txt: one input per line at a time in seconds of simulated time.
+//
+//   0.0  right down
+//   0.8  jump
+//   2.5  right up
+//
+// sweep.txt: one Tuning field per line (see Platformer.hpp), taking count
+// evenly spaced values from..to. Every combination is one run.
+//
+//   # name     from  to   count
+//   jumpSpeed  1.0   1.6  7
+//   gravity    0.2   0.4  5
+//
+// out.csv has one row per run: the swept values, whether and when the
+// player reached the exit, how many jumps that took, the highest jump and
+// where the player ended up. --arcs writes every jump of every run:
+// takeoff, apex and landing.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Box2D/Box2D.h>
+
+#include "Character.hpp"
+#include "Level.hpp"
+#include "Platformer.hpp"
+#include "ThreadPool.hpp"
+
+const float screenWidth = 1024; // px; the game's window, where bodies wrap around
+
+struct ScriptEvent
+{
+    float time;
+    enum { Left, Right, Jump } action;
+    bool down;
+};
+
+struct Axis
+{
+    std::string name;
+    float from, to;
+    int count;
+
+    float value(int i) const { return count > 1 ? from + (to - from) * i / (count - 1) : from; }
+};
+
+struct JumpArc
+{
+    float takeoffTime, takeoffX, takeoffY;
+    float apexY;
+    float landTime; // -1 if the next jump came first
+};
+
+struct Outcome
+{
+    bool reachedExit = false;
+    float time = 0; // of reaching the exit, or the time limit
+    float finalX = 0, finalY = 0;
+    std::vector<JumpArc> jumps;
+};
+
+static bool setTunable(Tuning& t, const std::string& name, float v)
+{
+    struct FloatField { const char* name; float Tuning::* field; };
+    static const FloatField floats[] = {
+        { "gravity", &Tuning::gravity }, { "jumpSpeed", &Tuning::jumpSpeed }, { "runSpeed", &Tuning::runSpeed },
+        { "spin", &Tuning::spin }, { "wallKick", &Tuning::wallKick }, { "wallLift", &Tuning::wallLift },
+        { "playerSize", &Tuning::playerSize }, { "playerDensity", &Tuning::playerDensity },
+        { "playerFriction", &Tuning::playerFriction }, { "playerRestitution", &Tuning::playerRestitution },
+        { "stepHz", &Tuning::stepHz },
+    };
+    struct IntField { const char* name; int Tuning::* field; };
+    static const IntField ints[] = {
+        { "maxJumps", &Tuning::maxJumps }, { "velocityIterations", &Tuning::velocityIterations },
+        { "positionIterations", &Tuning::positionIterations },
+    };
+    for (const FloatField& f : floats)
+        if (name == f.name) { t.*f.field = v; return true; }
+    for (const IntField& f : ints)
+        if (name == f.name) { t.*f.field = int(v + 0.5f); return true; }
+    return false;
+}
+
+static bool readFile(const std::string& path, std::string& out)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+static bool parseScript(std::istream& in, std::vector<ScriptEvent>& script, std::string& error)
+{
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); lineNo++) {
+        std::istringstream words(line);
+        ScriptEvent e;
+        std::string action, state;
+        if (!(words >> action) || action[0] == '#') continue;
+        e.time = float(atof(action.c_str()));
+        words >> action >> state;
+        e.down = state != "up";
+        if (action == "left") e.action = ScriptEvent::Left;
+        else if (action == "right") e.action = ScriptEvent::Right;
+        else if (action == "jump") e.action = ScriptEvent::Jump;
+        else {
+            error = "line " + std::to_string(lineNo) + ": " + line;
+            return false;
+        }
+        script.push_back(e);
+    }
+    std::stable_sort(script.begin(), script.end(),
+        [](const ScriptEvent& a, const ScriptEvent& b) { return a.time < b.time; });
+    return true;
+}
+
+static bool parseSweep(std::istream& in, std::vector<Axis>& axes, std::string& error)
+{
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); lineNo++) {
+        std::istringstream words(line);
+        Axis a;
+        if (!(words >> a.name) || a.name[0] == '#') continue;
+        Tuning probe;
+        if (!(words >> a.from >> a.to >> a.count) || a.count < 1 || !setTunable(probe, a.name, a.from)) {
+            error = "line " + std::to_string(lineNo) + ": " + line;
+            return false;
+        }
+        axes.push_back(a);
+    }
+    return true;
+}
+
+// One run, in a world of its own.
+static Outcome play(const LevelView& level, const Tuning& t, const std::vector<ScriptEvent>& script,
+                    float timeLimit, unsigned seed)
+{
+    b2World world(b2Vec2(0, t.gravity));
+    std::minstd_rand rng(seed);
+
+    buildScenery(world, level);
+    for (uint32_t i = 0; i < level.count(); i++) {
+        const LevelBody& b = level.bodies()[i];
+        if (isScenery(b)) continue;
+        Recipe r = levelRecipe(b, level.fixtures()[i]);
+        randomizeAngle(r, rng);
+        r.build(world);
+    }
+
+    Characters characters;
+    characters.tuning = t;
+    Character& player = characters[characters.add(playerRecipe(t).build(world))];
+    world.SetContactListener(&characters);
+
+    Outcome out;
+    float dt = 1 / t.stepHz;
+    StepInput in = {};
+    size_t next = 0;
+    bool inAir = false;
+
+    // The script becomes one StepInput per step, played through the same
+    // platformerStep as the game and the replays. A jump line is a press:
+    // Jump is held for that step only.
+    for (int step = 0; step * dt < timeLimit; step++) {
+        float time = step * dt;
+        b2Vec2 p = player.body->GetPosition();
+
+        in.held &= ~StepInput::Jump;
+        for (; next < script.size() && script[next].time <= time; next++) {
+            const ScriptEvent& e = script[next];
+            uint8_t bit = e.action == ScriptEvent::Left ? StepInput::Left
+                        : e.action == ScriptEvent::Right ? StepInput::Right : StepInput::Jump;
+            if (e.down) in.held |= bit;
+            else in.held &= ~bit;
+        }
+        // Characters::apply jumps on this press if any jumps are left.
+        if ((in.held & ~player.lastHeld & StepInput::Jump) && player.jumpCount < t.maxJumps) {
+            out.jumps.push_back({ time, p.x * PPM, p.y * PPM, p.y * PPM, -1 });
+            inAir = true;
+        }
+
+        platformerStep(world, characters, &in, dt, screenWidth, [](b2Body*) {});
+
+        p = player.body->GetPosition();
+        if (inAir) {
+            JumpArc& arc = out.jumps.back();
+            arc.apexY = std::min(arc.apexY, p.y * PPM);
+            if (player.jumpCount == 0) {
+                arc.landTime = time + dt;
+                inAir = false;
+            }
+        }
+        if (player.reachedExit) {
+            out.reachedExit = true;
+            out.time = time + dt;
+            break;
+        }
+        out.time = time + dt;
+    }
+
+    out.finalX = player.body->GetPosition().x * PPM;
+    out.finalY = player.body->GetPosition().y * PPM;
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 5) {
+        printf("usage: sweep <level.lvl|level.txt> <script.txt> <sweep.txt> <out.csv>"
+               " [--arcs arcs.csv] [--time 30] [--threads 0] [--seed 1]\n");
+        return 1;
+    }
+    std::string levelPath = argv[1], arcsPath;
+    float timeLimit = 30;
+    unsigned threads = 0, seed = 1;
+    for (int i = 5; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--arcs")) arcsPath = argv[i + 1];
+        else if (!strcmp(argv[i], "--time")) timeLimit = float(atof(argv[i + 1]));
+        else if (!strcmp(argv[i], "--threads")) threads = unsigned(atoi(argv[i + 1]));
+        else if (!strcmp(argv[i], "--seed")) seed = unsigned(atoi(argv[i + 1]));
+    }
+
+    // The level, compiled in memory if given as text. Every world reads it.
+    std::string bytes, error;
+    std::vector<uint8_t> compiled;
+    if (!readFile(levelPath, bytes)) {
+        printf("sweep: can't read %s\n", levelPath.c_str());
+        return 1;
+    }
+    const uint8_t* data = (const uint8_t*)bytes.data();
+    size_t size = bytes.size();
+    if (levelPath.size() > 4 && levelPath.compare(levelPath.size() - 4, 4, ".txt") == 0) {
+        std::istringstream text(bytes);
+        if (!compileLevel(text, compiled, error)) {
+            printf("sweep: %s: %s\n", levelPath.c_str(), error.c_str());
+            return 1;
+        }
+        data = compiled.data();
+        size = compiled.size();
+    }
+    LevelView level;
+    if (!level.open(data, size)) {
+        printf("sweep: %s: not a level\n", levelPath.c_str());
+        return 1;
+    }
+
+    std::vector<ScriptEvent> script;
+    std::vector<Axis> axes;
+    std::ifstream scriptIn(argv[2]), sweepIn(argv[3]);
+    if (!scriptIn || !parseScript(scriptIn, script, error)) {
+        printf("sweep: %s: %s\n", argv[2], scriptIn ? error.c_str() : "can't read");
+        return 1;
+    }
+    if (!sweepIn || !parseSweep(sweepIn, axes, error)) {
+        printf("sweep: %s: %s\n", argv[3], sweepIn ? error.c_str() : "can't read");
+        return 1;
+    }
+
+    // Every combination of the axes; the last one varies fastest.
+    int runs = 1;
+    for (const Axis& a : axes) runs *= a.count;
+    std::vector<Tuning> tunings(runs);
+    std::vector<float> swept(runs * axes.size()); // the axes' values, a row per run
+    for (int r = 0; r < runs; r++) {
+        int rest = r;
+        for (int k = int(axes.size()) - 1; k >= 0; k--) {
+            float v = axes[k].value(rest % axes[k].count);
+            setTunable(tunings[r], axes[k].name, v);
+            swept[r * axes.size() + k] = v;
+            rest /= axes[k].count;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Outcome> outcomes(runs);
+    {
+        ThreadPool pool(threads);
+        pool.parallelFor(runs, [&](int r) {
+            outcomes[r] = play(level, tunings[r], script, timeLimit, seed);
+        });
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FILE* out = fopen(argv[4], "w");
+    if (!out) {
+        printf("sweep: can't write %s\n", argv[4]);
+        return 1;
+    }
+    fprintf(out, "run");
+    for (const Axis& a : axes) fprintf(out, ",%s", a.name.c_str());
+    fprintf(out, ",reachedExit,time,jumps,highestJump,finalX,finalY\n");
+    for (int r = 0; r < runs; r++) {
+        const Outcome& o = outcomes[r];
+        float highest = 0;
+        for (const JumpArc& j : o.jumps) highest = std::max(highest, j.takeoffY - j.apexY);
+        fprintf(out, "%d", r);
+        for (size_t k = 0; k < axes.size(); k++) fprintf(out, ",%g", swept[r * axes.size() + k]);
+        fprintf(out, ",%d,%.4f,%d,%.2f,%.2f,%.2f\n", o.reachedExit, o.time, int(o.jumps.size()), highest,
+            o.finalX, o.finalY);
+    }
+    fclose(out);
+
+    if (!arcsPath.empty()) {
+        FILE* arcs = fopen(arcsPath.c_str(), "w");
+        if (!arcs) {
+            printf("sweep: can't write %s\n", arcsPath.c_str());
+            return 1;
+        }
+        fprintf(arcs, "run,jump,takeoffTime,takeoffX,takeoffY,apexY,landTime\n");
+        for (int r = 0; r < runs; r++) {
+            for (size_t j = 0; j < outcomes[r].jumps.size(); j++) {
+                const JumpArc& a = outcomes[r].jumps[j];
+                fprintf(arcs, "%d,%d,%.4f,%.2f,%.2f,%.2f,%.4f\n", r, int(j), a.takeoffTime, a.takeoffX,
+                    a.takeoffY, a.apexY, a.landTime);
+            }
+        }
+        fclose(arcs);
+    }
+
+    printf("%d runs in %.2f s (%.0f runs/min)\n", runs, seconds, runs / seconds * 60);
+    return 0;
+}
@@ -1,5 +1,8 @@
 #include <SFML/Graphics.hpp>
 #include <time.h>
+
+#include "FrameCapture.hpp"
+#include "ResourceCache.hpp"
 using namespace sf;
 
 const int M = 20;
@@ -44,24 +47,30 @@ int main()
 
   RenderWindow window(VideoMode(320, 480), "The Game!", sf::Style::Titlebar || sf::Style::None);
 
-  Texture t1,t2,t3;
-  t1.loadFromFile("images/tiles.png");
-  t2.loadFromFile("images/background.png");
-  t3.loadFromFile("images/frame.png");
+  AssetPack::mounted().open("tetris.pak"); // loose files when absent
+  Resources& res = Resources::get();
+  auto t1 = res.textures.acquire("images/tiles.png");
+  auto t2 = res.textures.acquire("images/background.png");
+  auto t3 = res.textures.acquire("images/frame.png");
+  if (!t1 || !t2 || !t3) {
+    printf("Image files not found\n");
+    exit(0);
+  }
 
-  Sprite s(t1), background(t2), frame(t3);
+  Sprite s(*t1), background(*t2), frame(*t3);
 //  Vector2f v = Vector2f(2.0, 2.0);
 //  s.scale(v);
 
 
   Text debug;
-  Font font = Font();
-  if (!font.loadFromFile("fonts/arial.ttf")) {
+  auto font = res.fonts.acquire("fonts/arial.ttf");
+  if (!font) {
     printf("Font file not found\n");
     exit(0);
   }
+  res.report();
 
-  debug.setFont(font);
+  debug.setFont(*font);
   debug.setFillColor(Color::Red);
   debug.setCharacterSize(40);
   //debug.setPosition(0.f, 0.f);
@@ -71,12 +80,20 @@ int main()
   int dx = 0; bool rotate=0; int colorNum=1;
   float timer=0, delay=0.3;
 
+  // [F5] records frames at 2x to capture/, one fixed 1/60 s step each.
+  FrameCapture capture;
+  if (!capture.create(640, 960, View(FloatRect(0, 0, 320, 480)))) exit(0);
+  Text recText("", *font, 14);
+  recText.setFillColor(Color::Red);
+  recText.setPosition(5.f, 460.f);
+
   Clock clock;
 
   while (window.isOpen())
   {
     float time = clock.getElapsedTime().asSeconds();
     clock.restart();
+    if (capture.recording) time = capture.step.asSeconds();
     timer += time;
 
     Event e;
@@ -89,7 +106,13 @@ int main()
         if (e.key.code  == Keyboard::Up) rotate = true;
         else if (e.key.code == Keyboard::Left) dx = -1;
         else if (e.key.code == Keyboard::Right) dx = 1;
-        else if (e.key.code == Keyboard::Escape) exit(0);
+        else if (e.key.code == Keyboard::F5) {
+          if (capture.recording) capture.stop();
+          else capture.start("capture");
+          // Real-time pacing, so the writers keep up instead of dropping.
+          window.setFramerateLimit(capture.recording ? 60 : 0);
+        }
+        else if (e.key.code == Keyboard::Escape) { capture.finish(); exit(0); }
       }
     }
 
@@ -151,7 +174,8 @@ int main()
     dx = 0; rotate = 0; delay = 0.3;
 
     // Draw
-    window.clear(Color::White);
+    RenderTarget& target = capture.recording ? capture.begin() : static_cast<RenderTarget&>(window);
+    target.clear(Color::White);
     //window.draw(background);
 
     sf::Vertex line[2];
@@ -159,7 +183,7 @@ int main()
     line[0].color  = sf::Color::Red;
     line[1].position = sf::Vector2f(M*tileSize, 10);
     line[1].color = sf::Color::Red;
-    window.draw(line, 2, Quads);
+    target.draw(line, 2, Quads);
 
     sf::VertexArray lines(sf::LinesStrip, M*2);
     for (int i=0;i<M*2;i+=2) {
@@ -168,7 +192,7 @@ int main()
       lines[i+1].position = sf::Vector2f(M*tileSize, tileSize*i);
       lines[i+1].color  = sf::Color::Blue;
     }
-    window.draw(lines);
+    target.draw(lines);
 
 
     for (int i=0;i<M;i++) {
@@ -177,7 +201,7 @@ int main()
         s.setTextureRect(IntRect(field[i][j]*tileSize,0,tileSize,tileSize));
         s.setPosition(j*tileSize,i*tileSize);
         s.move(28,31); //offset
-        window.draw(s);
+        target.draw(s);
       }
     }
 
@@ -185,14 +209,19 @@ int main()
       s.setTextureRect(IntRect(colorNum*tileSize,0,tileSize,tileSize));
       s.setPosition(a[i].x*tileSize, a[i].y*tileSize);
       s.move(28,31); //offset
-      window.draw(s);
+      target.draw(s);
     }
 
 
 
     //window.draw(frame);
     debug.setString("DEBUG");
-    window.draw(debug);
+    target.draw(debug);
+    if (capture.recording) {
+      capture.end(window);
+      recText.setString(capture.status());
+      window.draw(recText);
+    }
     window.display();
   }
 
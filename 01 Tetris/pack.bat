@@ -0,0 +1 @@
+..\tools\packer\packer.exe tetris.pak -c --raw images/tiles.png images fonts/arial.ttf
\ No newline at end of file
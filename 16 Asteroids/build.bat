@@ -1 +1 @@
-cl.exe /I..\sfml\include main.cpp /link /libpath:..\sfml\lib sfml-system.lib sfml-window.lib sfml-graphics.lib sfml-audio.lib /out:asteroids.exe
+cl.exe /EHsc /I..\sfml\include /I..\common main.cpp /link /libpath:..\sfml\lib sfml-system.lib sfml-window.lib sfml-graphics.lib sfml-audio.lib /out:asteroids.exe
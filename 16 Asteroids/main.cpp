@@ -1,9 +1,19 @@
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
 
-#include <list>
+#include <algorithm>
+#include <cmath>
+#include <memory>
 #include <vector>
 
+#include "AssetLoader.hpp"
+#include "Ecs.hpp"
+#include "FrameCapture.hpp"
+#include "InputSampler.hpp"
+#include "Profiler.hpp"
+#include "ResourceCache.hpp"
+#include "ThreadPool.hpp"
+
 using namespace sf;
 
 //const int W = 1920;
@@ -16,11 +26,13 @@ const int H = 1080;
 float DEGTORAD = 0.017453f;
 
 bool fullScreen = false;
+bool proceduralStars = true; // false: draw images/stars2.jpg instead
+int botsPerTeam = 0;         // AI ships added to each team on top of Blue/Green
 
 class Score
 {
   void config(Text& t) {
-    t.setFont(font);
+    t.setFont(*font);
     t.setCharacterSize(45);
   }
   std::string makeString(int score, int bullets) {
@@ -29,7 +41,7 @@ class Score
   }
 
 public:
-  Score(Font f) { 
+  Score(std::shared_ptr<Font> f) {
     font = f;
     config(blue);
     config(green);
@@ -43,7 +55,7 @@ public:
     green.setString(s);
     green.setPosition(W-220, 100);
   }
-  Font font;
+  std::shared_ptr<Font> font;
   Text blue;
   Text green;
 
@@ -55,32 +67,34 @@ public:
     std::string s = makeString(score, bullets);
     green.setString(s);
   }
-  void draw(RenderWindow& window) {
-    window.draw(blue);
-    window.draw(green);
+  void draw(RenderTarget& target) {
+    target.draw(blue);
+    target.draw(green);
   }  
 };
 
 class Debug
 {
   void config(Text& t, int px, int py) {
-    t.setFont(font);
+    t.setFont(*font);
     t.setCharacterSize(24);
     t.setFillColor(Color::White);
     t.setPosition(px, py);
   }
 
 public:
-  Font font;
+  std::shared_ptr<Font> font;
   Text x;
   Text y;
   Text b;
+  Text latency;
 
-  Debug(Font f, int px, int py) {
+  Debug(std::shared_ptr<Font> f, int px, int py) {
     font = f;
     config(x, px, py);
     config(y, px, py+20);
     config(b, px, py+40);
+    config(latency, px, py+60);
   }
 
   void update(int jx, int jy, int bt) {
@@ -93,10 +107,190 @@ public:
     b.setString(sb);
   }
 
+  void updateLatency(const InputSampler& input) {
+    char s[64];
+    snprintf(s, sizeof(s), "input: %.2f ms avg, %.2f ms max", input.latencyAvg / 1000, input.latencyMax / 1000.0);
+    latency.setString(s);
+  }
+
   void draw(RenderWindow& window) {
     window.draw(x);
     window.draw(y);
     window.draw(b);
+    window.draw(latency);
+  }
+};
+
+// A W x H view of a target of the given size, letterboxed or pillarboxed so
+// the scene keeps its aspect ratio; the bars are whatever clear() left.
+View letterboxView(Vector2u size)
+{
+  View view(FloatRect(0, 0, W, H));
+  float target = float(size.x) / size.y, scene = float(W) / H;
+  if (target > scene) view.setViewport(FloatRect((1 - scene / target) / 2, 0, scene / target, 1));
+  else view.setViewport(FloatRect(0, (1 - target / scene) / 2, 1, target / scene));
+  return view;
+}
+
+// Renders the scene into an offscreen texture and stretches it over the
+// window. The scene view always covers W x H world units; only the viewport
+// inside the texture shrinks when frames run over budget, so gameplay code
+// never sees the render scale and the texture is allocated once.
+class DynamicResolution
+{
+  RenderTexture target;
+  Sprite sprite;
+  View sceneView;
+  View windowView;
+
+  Clock workClock;
+  Clock frameClock;
+  float workTime = 0;   // smoothed CPU time from startFrame() to display()
+  float frameTime = 0;  // smoothed time between two display() calls
+  int cooldown = 0;
+
+  void applyScale() {
+    sceneView.setViewport(FloatRect(0, 0, scale, scale));
+    sprite.setTextureRect(IntRect(0, 0, int(W * scale), int(H * scale)));
+    sprite.setScale(1.0f / scale, 1.0f / scale);
+  }
+
+public:
+  float scale = 1.0f;
+  float minScale = 0.5f;
+  float budget = 1.0f / 60;
+  bool enabled = true;
+
+  bool create() {
+    if (!target.create(W, H)) return false;
+    target.setSmooth(true);
+    sprite.setTexture(target.getTexture());
+    sceneView.reset(FloatRect(0, 0, W, H));
+    windowView.reset(FloatRect(0, 0, W, H));
+    applyScale();
+    return true;
+  }
+
+  // Call at the top of the frame, before events and the simulation, so the
+  // work time covers everything the CPU does for the frame.
+  void startFrame() {
+    workClock.restart();
+  }
+
+  RenderTarget& begin() {
+    target.setView(sceneView);
+    target.clear();
+    return target;
+  }
+
+  // Draws the scene texture into the window (or a capture target), letterboxed
+  // to the scene's aspect ratio. HUD drawn after this call lands there at
+  // native resolution, in the same world units.
+  void present(RenderTarget& window) {
+    target.display();
+    windowView = letterboxView(window.getSize());
+    window.setView(windowView);
+    window.clear();
+    window.draw(sprite);
+  }
+
+  // Call right before window.display(); adapts the scale for the next frame.
+  void update() {
+    const float k = 0.1f;
+    workTime += (workClock.getElapsedTime().asSeconds() - workTime) * k;
+    frameTime += (frameClock.restart().asSeconds() - frameTime) * k;
+
+    if (!enabled) {
+      if (scale != 1.0f) { scale = 1.0f; applyScale(); }
+      return;
+    }
+    if (cooldown > 0) { cooldown--; return; }
+
+    // The frame limiter sleeps inside display(), so a long frame interval
+    // with a short CPU time means the GPU is the one falling behind.
+    bool over = workTime > budget * 0.9f || frameTime > budget * 1.2f;
+    bool under = workTime < budget * 0.6f && frameTime < budget * 1.05f;
+
+    float s = scale;
+    if (over) s = std::max(minScale, scale - 0.1f);
+    else if (under) s = std::min(1.0f, scale + 0.05f);
+
+    if (s != scale) {
+      scale = s;
+      applyScale();
+      cooldown = 30;
+    }
+  }
+};
+
+// Procedural background: a few layers of stars baked once into static vertex
+// buffers. Each layer holds its stars tiled 2 x 2 over a 2W x 2H area, so a
+// wrapped scroll offset in [0, W) x [0, H) is always one draw call.
+class Starfield
+{
+  struct Layer {
+    VertexBuffer buffer;
+    VertexArray fallback;
+    float parallax;
+    Vector2f offset;
+  };
+  Layer layers[3];
+
+  void addStar(VertexArray& va, float x, float y, float size, Color c) {
+    for (int tx = 0; tx < 2; tx++) {
+      for (int ty = 0; ty < 2; ty++) {
+        float px = x + tx * W, py = y + ty * H;
+        va.append(Vertex(Vector2f(px, py), c));
+        va.append(Vertex(Vector2f(px + size, py), c));
+        va.append(Vertex(Vector2f(px + size, py + size), c));
+        va.append(Vertex(Vector2f(px, py + size), c));
+      }
+    }
+  }
+
+public:
+  void create(unsigned seed) {
+    const int counts[3] = { 1500, 500, 150 };
+    const float sizes[3] = { 1, 2, 3 };
+    const float parallax[3] = { 0.05f, 0.15f, 0.4f };
+    const bool gpu = VertexBuffer::isAvailable();
+
+    srand(seed);
+    for (int i = 0; i < 3; i++) {
+      Layer& l = layers[i];
+      l.parallax = parallax[i];
+      l.fallback.setPrimitiveType(Quads);
+      for (int n = 0; n < counts[i]; n++) {
+        Uint8 v = 90 + i * 50 + rand() % 40;
+        Color c(v, v, std::min(255, v + rand() % 60));
+        addStar(l.fallback, rand() % W, rand() % H, sizes[i], c);
+      }
+      if (gpu) {
+        l.buffer.setPrimitiveType(Quads);
+        l.buffer.setUsage(VertexBuffer::Static);
+        if (l.buffer.create(l.fallback.getVertexCount())) {
+          l.buffer.update(&l.fallback[0]);
+          l.fallback.clear();
+        }
+      }
+    }
+  }
+
+  // Moves the layers against the camera motion (dx, dy) in world units.
+  void scroll(float dx, float dy) {
+    for (Layer& l : layers) {
+      l.offset.x = fmod(l.offset.x + dx * l.parallax + W, (float)W);
+      l.offset.y = fmod(l.offset.y + dy * l.parallax + H, (float)H);
+    }
+  }
+
+  void draw(RenderTarget& target) {
+    for (Layer& l : layers) {
+      RenderStates states;
+      states.transform.translate(-l.offset);
+      if (l.buffer.getVertexCount() > 0) target.draw(l.buffer, states);
+      else target.draw(l.fallback, states);
+    }
   }
 };
 
@@ -134,58 +328,44 @@ public:
    }  
 };
 
-class Entity
+// Components. What an entity is follows from what it carries: every drawn
+// thing has a Position and an Animation, ships add Ship, ShipFrames and
+// Controls, bullets add Bullet, explosions add Explosion.
+struct Position { float x, y, angle; };
+struct Motion { float dx, dy; float px, py; }; // px, py: position before the last update, for swept collision
+struct Collider { float r; };
+struct Ship { int player; int team; };         // index into players; 0 blue, 1 green
+struct ShipFrames { IntRect quiet, go; };
+struct Controls { int turn; bool thrust; };   // written by the owning Player each tick
+struct Bullet { int team; };
+struct Explosion {};
+
+EntityId spawnShip(Registry& reg, int player, int team, Animation& quiet, Animation& go, float x, float y, float angle)
 {
-public:
-  float x, y, dx, dy, r, angle;
-  bool life;
-  std::string name;
-  Animation anim;
-  Animation animQuiet;
-
-  Entity() { life = 1; }
-  void settings(Animation& a, int X, int Y, float Angle = 0, int radius = 1) {
-    x = X; y = Y; anim = a; animQuiet = a;
-    angle = Angle; r = radius;
-  }
-
-  virtual void update() {};
-
-  virtual void draw(RenderWindow& window) {
-    anim.sprite.setPosition(x, y);
-    anim.sprite.setRotation(angle + 90);
-    window.draw(anim.sprite);
-  }
-};
+  return reg.create(Position{ x, y, angle }, Motion{ 0, 0, x, y }, Collider{ 20 }, quiet,
+    Ship{ player, team }, ShipFrames{ quiet.frames[0], go.frames[0] }, Controls{ 0, false });
+}
 
-class Bullet : public  Entity
+EntityId spawnBullet(Registry& reg, int team, Animation& a, float x, float y, float angle)
 {
-public:
-  Bullet(std::string s) { name = s; }
-  void update() {
-    dx = cos(angle * DEGTORAD) * 30;
-    dy = sin(angle * DEGTORAD) * 30;
-    x += dx;
-    y += dy;
-    if (x > W || x<0 || y>H || y < 0) life = 0;
-  }
-};
+  return reg.create(Position{ x, y, angle }, Motion{ 0, 0, x, y }, Collider{ 10 }, a, Bullet{ team });
+}
 
-class Asteroid : public Entity
+EntityId spawnExplosion(Registry& reg, Animation& a, float x, float y)
 {
+  return reg.create(Position{ x, y, 0 }, a, Explosion());
+}
 
-};
-
-class Player : public Entity
+class Player
 {
   const Joystick::Axis padAxisX = static_cast<Joystick::Axis>(0);
   const Joystick::Axis padAxisY = static_cast<Joystick::Axis>(1);
   const int padButtonA = 0;
 
-  Animation animGo;
   Animation sBullet;
-  std::list<Entity*>& entities;
 
+  std::shared_ptr<SoundBuffer> laserBuffer;
+  std::shared_ptr<SoundBuffer> rechargeBuffer;
   Sound laserSound;
   Sound rechargeSound;
 
@@ -193,6 +373,10 @@ class Player : public Entity
   bool outOfBullets = false;
 
 public:
+  std::string name;
+  EntityId ship = noEntity;
+  int team;
+
   int jx = 0, jy = 0;
   bool buttonA = false;
   bool pressedButtonA = false;
@@ -201,52 +385,35 @@ public:
   int bullets;
   int score = 0;
 
-  Player(std::string s, Animation& ag, Animation& a, Sound& snd1, Sound& snd2, std::list<Entity*>& e) : entities(e) {
+  bool ai = false;
+  int aiFireDelay = 0;
+
+  Player(std::string s, Animation& a, std::shared_ptr<SoundBuffer> laser,
+         std::shared_ptr<SoundBuffer> recharge) {
     name = s;
-    animGo = ag;
+    team = s == "Blue" ? 0 : 1;
     sBullet = a;
-    laserSound = snd1;
-    rechargeSound = snd2;
+    laserBuffer = laser;
+    rechargeBuffer = recharge;
+    laserSound.setBuffer(*laserBuffer);
+    rechargeSound.setBuffer(*rechargeBuffer);
     bullets = 30;
     score = 0;
   }
 
-  void update()
+  // Hands the held inputs to the ship and fires on a button press. The
+  // movement itself happens in the ships system.
+  void update(Registry& reg)
   {
-    if (jx >= 40.0) angle += 3;
-    else if (jx <= -40) angle -= 3;
-
-    if (thrust) {
-      dx += cos(angle * DEGTORAD) * 0.2;
-      dy += sin(angle * DEGTORAD) * 0.2;
-      anim = animGo;
-    }
-    else {
-      dx *= 0.99;
-      dy *= 0.99;
-      anim = animQuiet;
-    }
-
-    int maxSpeed = 15;
-    float speed = sqrt(dx * dx + dy * dy);
-    if (speed > maxSpeed) {
-      dx *= maxSpeed / speed;
-      dy *= maxSpeed / speed;
-    }
-
-    x += dx;
-    y += dy;
-
-    if (x > W) x = 0; if (x < 0) x = W; 
-    if (y > H) y = 0; if (y < 0) y = H;
+    Controls& c = reg.get<Controls>(ship);
+    c.turn = jx >= 40 ? 1 : jx <= -40 ? -1 : 0;
+    c.thrust = thrust;
 
     if (pressedButtonA && buttonA == false) {
       if (bullets > 0) {
         bullets--;
-        std::string bname = "bullet" + name;
-        Bullet* b = new Bullet(bname);
-        b->settings(sBullet, x, y, angle, 10);
-        entities.push_back(b);
+        Position t = reg.get<Position>(ship);
+        spawnBullet(reg, team, sBullet, t.x, t.y, t.angle);
         laserSound.play();
       } else {
         rechargeSound.play();
@@ -266,30 +433,533 @@ public:
     }
   }
 
-  void joystick(int id) {
-
-    jx = Joystick::getAxisPosition(id, padAxisX);
-    jy = Joystick::getAxisPosition(id, padAxisY);
-
-    if (jy >= -20) thrust = false;
-    if (jy < -20) thrust = true;
-
-    if (Joystick::isButtonPressed(id, padButtonA)) {
+  // Applies one sampled joystick change. pressedButtonA latches the press, so
+  // a press and release drained in the same tick still fire.
+  void joystick(const InputEvent& e) {
+    if (e.type == InputEvent::AxisMoved) {
+      if (e.axis == padAxisX) jx = e.position;
+      if (e.axis == padAxisY) {
+        jy = e.position;
+        thrust = jy < -20;
+      }
+    }
+    else if (e.type == InputEvent::ButtonPressed && e.button == padButtonA) {
       buttonA = true;
       pressedButtonA = true;
-    } else {
+    }
+    else if (e.type == InputEvent::ButtonReleased && e.button == padButtonA) {
+      buttonA = false;
+    }
+  }
+
+  // Same inputs as joystick(), chosen by an AiPilots planner instead.
+  void control(int turn, bool thrustOn, bool fire) {
+    jx = turn * 100;
+    thrust = thrustOn;
+    if (fire) {
+      pressedButtonA = true;
       buttonA = false;
     }
   }
 };
 
-bool isCollide(Entity* a, Entity* b)
+// Ship and bullet movement, run per entity across the pool.
+void stepShip(Position& t, Motion& m, const Controls& c)
 {
-  return (b->x - a->x) * (b->x - a->x) +
-    (b->y - a->y) * (b->y - a->y) <
-    (a->r + b->r) * (a->r + b->r);
+  m.px = t.x; m.py = t.y;
+  t.angle += 3 * c.turn;
+
+  if (c.thrust) {
+    m.dx += cos(t.angle * DEGTORAD) * 0.2;
+    m.dy += sin(t.angle * DEGTORAD) * 0.2;
+  }
+  else {
+    m.dx *= 0.99;
+    m.dy *= 0.99;
+  }
+
+  int maxSpeed = 15;
+  float speed = sqrt(m.dx * m.dx + m.dy * m.dy);
+  if (speed > maxSpeed) {
+    m.dx *= maxSpeed / speed;
+    m.dy *= maxSpeed / speed;
+  }
+
+  t.x += m.dx;
+  t.y += m.dy;
+
+  if (t.x > W) t.x = 0;
+  if (t.x < 0) t.x = W;
+  if (t.y > H) t.y = 0;
+  if (t.y < 0) t.y = H;
+}
+
+// Returns false once the bullet has left the screen.
+bool stepBullet(Position& t, Motion& m)
+{
+  m.px = t.x; m.py = t.y;
+  m.dx = cos(t.angle * DEGTORAD) * 30;
+  m.dy = sin(t.angle * DEGTORAD) * 30;
+  t.x += m.dx;
+  t.y += m.dy;
+  // Keep the bullet for the tick that carries it off screen so that its
+  // last segment still goes through the swept collision test.
+  return !(m.px > W || m.px < 0 || m.py > H || m.py < 0);
+}
+
+// What the collision pass needs of a ship or bullet, gathered into one array.
+struct Collidable
+{
+  EntityId id;
+  float x, y, px, py, r;
+  int team;
+};
+
+// Motion over the last tick, or none if the entity wrapped around the screen
+// edge (a wrap is a teleport, not a path that can hit anything).
+Vector2f lastMotion(const Collidable& e)
+{
+  Vector2f d(e.x - e.px, e.y - e.py);
+  if (std::abs(d.x) > W / 2 || std::abs(d.y) > H / 2) return Vector2f(0, 0);
+  return d;
+}
+
+// True if the segment start..end passes within r of the origin.
+bool segmentHitsOrigin(Vector2f start, Vector2f end, float r)
+{
+  Vector2f d = end - start;
+  float len2 = d.x * d.x + d.y * d.y;
+  float t = 0;
+  if (len2 > 0) {
+    t = -(start.x * d.x + start.y * d.y) / len2;
+    t = std::max(0.0f, std::min(1.0f, t));
+  }
+  Vector2f c = start + d * t;
+  return c.x * c.x + c.y * c.y < r * r;
+}
+
+// Circle vs. circle collision that treats both circles as moving linearly
+// over the last tick and tests the closest approach, which is a segment vs.
+// circle test in a's frame of reference. Fast bullets can't tunnel through
+// ships however low the tick rate gets.
+bool isSweptCollide(const Collidable& a, const Collidable& b)
+{
+  Vector2f ma = lastMotion(a), mb = lastMotion(b);
+  Vector2f end(b.x - a.x, b.y - a.y);
+  Vector2f start = end - (mb - ma);
+  return segmentHitsOrigin(start, end, a.r + b.r);
 }
 
+// Rocks. Large rocks split into two medium ones, medium into two small, and
+// small ones just break up.
+enum RockSize { Large, Medium, Small, RockSizes };
+
+struct Rock { int tier; float frame; bool active; };
+
+struct RockTier
+{
+  float radius, scale, speed;
+  int weight;     // mass units for density control; a split keeps the mass
+  int splitInto;
+  int child;
+};
+
+const RockTier rockTiers[RockSizes] = {
+  { 38, 1.5f, 1.0f, 4, 2, Medium },
+  { 25, 1.0f, 1.5f, 2, 2, Small },
+  { 15, 1.0f, 2.0f, 1, 0, -1 },
+};
+
+// A wave releases count large rocks from the screen edges, one every
+// interval ticks, while the field holds less than maxMass. It ends once all
+// of them are released and nothing is left; the last wave repeats.
+struct WaveDef { int count; int interval; int maxMass; float speed; };
+
+const WaveDef waves[] = {
+  {   8, 90,  48, 1.0f },
+  {  16, 60,  96, 1.3f },
+  {  40, 30, 200, 1.6f },
+  { 120,  6, 600, 2.0f },
+};
+
+// Owns every rock entity. Each tier has a pool created up front and sized
+// from the wave table, so spawning and splitting only flip Rock::active and
+// never allocate, however many rocks break in one frame. A spawn that finds
+// its pool empty is skipped and counted in exhausted. Rocks and their debris
+// are drawn as one vertex batch per tier.
+class AsteroidField
+{
+  struct Debris { float x, y, frame, scale; };
+
+  Registry& reg;
+  std::vector<EntityId> idle[RockSizes];
+  size_t capacity[RockSizes];
+  std::vector<Debris> debris;
+  size_t debrisCapacity = 0;
+
+  const Texture* textures[RockSizes];
+  const Texture* debrisTexture;
+  VertexArray batches[RockSizes];
+  VertexArray debrisBatch;
+
+  int mass = 0;
+  size_t wave = 0;
+  int released = 0;
+  int cooldown = 0;
+
+  static float random(float lo, float hi) { return lo + (hi - lo) * (rand() % 1000) / 1000.0f; }
+
+  static void addQuad(VertexArray& batch, float x, float y, float angle, float half, IntRect rect) {
+    float c = cos(angle * DEGTORAD) * half, s = sin(angle * DEGTORAD) * half;
+    Vector2f corners[4] = { Vector2f(-c + s, -s - c), Vector2f(c + s, s - c), Vector2f(c - s, s + c), Vector2f(-c - s, -s + c) };
+    Vector2f uv[4] = {
+      Vector2f(rect.left, rect.top), Vector2f(rect.left + rect.width, rect.top),
+      Vector2f(rect.left + rect.width, rect.top + rect.height), Vector2f(rect.left, rect.top + rect.height) };
+    for (int i = 0; i < 4; i++) batch.append(Vertex(Vector2f(x, y) + corners[i], uv[i]));
+  }
+
+  // A point just outside a random screen edge.
+  static Vector2f edgePoint() {
+    switch (rand() % 4) {
+      case 0: return Vector2f(0, rand() % H);
+      case 1: return Vector2f(W, rand() % H);
+      case 2: return Vector2f(rand() % W, 0);
+      default: return Vector2f(rand() % W, H);
+    }
+  }
+
+public:
+  int exhausted = 0;
+  int destroyed = 0;
+
+  AsteroidField(Registry& r, const Texture& rock, const Texture& rockSmall, const Texture& explosion) : reg(r) {
+    textures[Large] = textures[Medium] = &rock;
+    textures[Small] = &rockSmall;
+    debrisTexture = &explosion;
+
+    // Mass never passes maxMass by more than one large rock, and splits keep
+    // it, so the worst case for a tier is all of that mass in its rocks.
+    int maxMass = 0;
+    for (auto& w : waves) maxMass = std::max(maxMass, w.maxMass);
+    size_t total = 0;
+    for (int t = 0; t < RockSizes; t++) {
+      capacity[t] = (maxMass + rockTiers[Large].weight) / rockTiers[t].weight;
+      total += capacity[t];
+    }
+    reg.reserve<Position, Motion, Collider, Rock>(total);
+    for (int t = 0; t < RockSizes; t++) {
+      idle[t].reserve(capacity[t]);
+      for (size_t i = 0; i < capacity[t]; i++)
+        idle[t].push_back(reg.create(Position{ 0, 0, 0 }, Motion{ 0, 0, 0, 0 }, Collider{ rockTiers[t].radius }, Rock{ t, 0, false }));
+      batches[t].setPrimitiveType(Quads);
+      batches[t].resize(capacity[t] * 4);
+      batches[t].clear(); // keeps the storage
+    }
+    debrisCapacity = total;
+    debris.reserve(debrisCapacity);
+    debrisBatch.setPrimitiveType(Quads);
+    debrisBatch.resize(debrisCapacity * 4);
+    debrisBatch.clear();
+  }
+
+  size_t poolSize(int tier) const { return capacity[tier]; }
+  size_t active(int tier) const { return capacity[tier] - idle[tier].size(); }
+  int waveNumber() const { return int(wave) + 1; }
+
+  bool spawn(int tier, float x, float y, float dx, float dy) {
+    if (idle[tier].empty()) {
+      exhausted++;
+      return false;
+    }
+    EntityId e = idle[tier].back();
+    idle[tier].pop_back();
+    reg.get<Position>(e) = Position{ x, y, float(rand() % 360) };
+    reg.get<Motion>(e) = Motion{ dx, dy, x, y };
+    reg.get<Rock>(e) = Rock{ tier, float(rand() % 16), true };
+    mass += rockTiers[tier].weight;
+    return true;
+  }
+
+  // Breaks a rock: debris where it was and its children flying apart.
+  void destroy(EntityId e) {
+    Rock& r = reg.get<Rock>(e);
+    if (!r.active) return;
+    r.active = false;
+    idle[r.tier].push_back(e);
+    mass -= rockTiers[r.tier].weight;
+    destroyed++;
+
+    const Position& p = reg.get<Position>(e);
+    const Motion& m = reg.get<Motion>(e);
+    if (debris.size() < debrisCapacity)
+      debris.push_back({ p.x, p.y, 0, rockTiers[r.tier].radius / 60 });
+
+    const RockTier& tier = rockTiers[r.tier];
+    for (int i = 0; i < tier.splitInto; i++) {
+      float a = random(0, 360) * DEGTORAD, v = rockTiers[tier.child].speed * random(1, 2);
+      spawn(tier.child, p.x, p.y, m.dx + cos(a) * v, m.dy + sin(a) * v);
+    }
+  }
+
+  // Once per tick on the main thread: waves, density control and debris.
+  void update() {
+    const WaveDef& w = waves[wave];
+    if (cooldown > 0) cooldown--;
+    if (released < w.count && cooldown == 0 && mass + rockTiers[Large].weight <= w.maxMass) {
+      Vector2f p = edgePoint();
+      float a = random(0, 360) * DEGTORAD, v = rockTiers[Large].speed * w.speed * random(1, 3);
+      if (spawn(Large, p.x, p.y, cos(a) * v, sin(a) * v)) released++;
+      cooldown = w.interval;
+    }
+    if (released == w.count && mass == 0) {
+      if (wave + 1 < sizeof(waves) / sizeof(waves[0])) wave++;
+      released = 0;
+    }
+
+    for (size_t i = 0; i < debris.size();) {
+      debris[i].frame += 0.5f;
+      if (debris[i].frame >= 48) {
+        debris[i] = debris.back();
+        debris.pop_back();
+      } else {
+        i++;
+      }
+    }
+  }
+
+  // Movement; runs across the pool, inactive rocks are skipped.
+  void step(ThreadPool& pool) {
+    reg.parallelEach<Position, Motion, Rock>(pool, [](EntityId, Position& p, Motion& m, Rock& r) {
+      if (!r.active) return;
+      m.px = p.x; m.py = p.y;
+      p.x += m.dx;
+      p.y += m.dy;
+      if (p.x > W) p.x = 0;
+      if (p.x < 0) p.x = W;
+      if (p.y > H) p.y = 0;
+      if (p.y < 0) p.y = H;
+      r.frame += 0.2f;
+      if (r.frame >= 16) r.frame -= 16;
+    });
+  }
+
+  void collidables(std::vector<Collidable>& out) {
+    reg.each<Position, Motion, Collider, Rock>([&](EntityId e, Position& p, Motion& m, Collider& c, Rock& r) {
+      if (r.active) out.push_back({ e, p.x, p.y, m.px, m.py, c.r, -1 });
+    });
+  }
+
+  void draw(RenderTarget& target) {
+    for (auto& b : batches) b.clear();
+    reg.each<Position, Rock>([&](EntityId, Position& p, Rock& r) {
+      if (!r.active) return;
+      addQuad(batches[r.tier], p.x, p.y, p.angle, 32 * rockTiers[r.tier].scale, IntRect(int(r.frame) * 64, 0, 64, 64));
+    });
+    for (int t = 0; t < RockSizes; t++)
+      if (batches[t].getVertexCount()) target.draw(batches[t], textures[t]);
+
+    debrisBatch.clear();
+    for (auto& d : debris)
+      addQuad(debrisBatch, d.x, d.y, 0, 128 * d.scale, IntRect(int(d.frame) * 256, 0, 256, 256));
+    if (debrisBatch.getVertexCount()) target.draw(debrisBatch, debrisTexture);
+  }
+};
+
+// Ship and bullet state as the pilots see it: plain values, cheap to copy.
+struct ShipState { float x, y, dx, dy, angle; int team; int bullets; };
+struct BulletState { float x, y, dx, dy; int team; };
+struct RockState { float x, y, dx, dy, r; };
+
+// Immutable picture of the world taken once per planning tick and shared by
+// every rollout of every bot. A rollout never writes to it: it copies only
+// its own ship and the bullet it fires, and reads everything else in place.
+struct WorldSnapshot
+{
+  std::vector<ShipState> ships;
+  std::vector<BulletState> bullets;
+  std::vector<RockState> rocks;
+};
+
+struct PilotAction { int turn; bool thrust; bool fire; };
+
+// Picks thrust, rotation and fire for AI ships by simulating each candidate
+// action a short horizon ahead. All (bot, action) rollouts of a tick run in
+// parallel on the game's shared pool.
+class AiPilots
+{
+  ThreadPool& pool;
+  std::vector<PilotAction> actions;
+  std::vector<float> scores;
+  std::vector<int> shipIndex;
+
+  static void wrap(float& x, float& y) {
+    if (x > W) x -= W;
+    if (x < 0) x += W;
+    if (y > H) y -= H;
+    if (y < 0) y += H;
+  }
+
+  // Mirrors the free stepShip() for one tick.
+  static void stepShip(ShipState& s, const PilotAction& a) {
+    s.angle += 3 * a.turn;
+    if (a.thrust) {
+      s.dx += cos(s.angle * DEGTORAD) * 0.2f;
+      s.dy += sin(s.angle * DEGTORAD) * 0.2f;
+    } else {
+      s.dx *= 0.99f;
+      s.dy *= 0.99f;
+    }
+    float speed = sqrt(s.dx * s.dx + s.dy * s.dy);
+    if (speed > 15) {
+      s.dx *= 15 / speed;
+      s.dy *= 15 / speed;
+    }
+    s.x += s.dx;
+    s.y += s.dy;
+    wrap(s.x, s.y);
+  }
+
+  float rollout(const WorldSnapshot& w, int self, const PilotAction& a) const {
+    const int horizon = 40;
+    ShipState me = w.ships[self];
+    bool shooting = a.fire && me.bullets > 0;
+    bool hit = false;
+    BulletState shot = { 0, 0, 0, 0, me.team };
+    float score = 0;
+
+    for (int t = 1; t <= horizon; t++) {
+      float weight = 1.0f - float(t) / (horizon + 1);
+      Vector2f before(me.x, me.y);
+      stepShip(me, a);
+      Vector2f motion(me.x - before.x, me.y - before.y);
+      if (std::abs(motion.x) > W / 2 || std::abs(motion.y) > H / 2) motion = Vector2f(0, 0);
+
+      if (shooting && t == 1) {
+        shot.x = me.x; shot.y = me.y;
+        shot.dx = cos(me.angle * DEGTORAD) * 30;
+        shot.dy = sin(me.angle * DEGTORAD) * 30;
+      } else if (shooting) {
+        shot.x += shot.dx; shot.y += shot.dy;
+        if (shot.x > W || shot.x < 0 || shot.y > H || shot.y < 0) shooting = false;
+      }
+
+      for (size_t i = 0; i < w.ships.size(); i++) {
+        const ShipState& e = w.ships[i];
+        if (e.team == me.team) continue;
+        float ex = e.x + e.dx * t, ey = e.y + e.dy * t;
+        wrap(ex, ey);
+        Vector2f rel(ex - me.x, ey - me.y);
+        if (segmentHitsOrigin(rel + motion - Vector2f(e.dx, e.dy), rel, 40)) score -= 50 * weight;
+        if (shooting && t > 1) {
+          Vector2f end(ex - shot.x, ey - shot.y);
+          if (segmentHitsOrigin(end + Vector2f(shot.dx, shot.dy) - Vector2f(e.dx, e.dy), end, 30)) {
+            score += 100 * weight;
+            shooting = false;
+            hit = true;
+          }
+        }
+      }
+
+      for (const BulletState& b : w.bullets) {
+        if (b.team == me.team) continue;
+        float bx = b.x + b.dx * t, by = b.y + b.dy * t;
+        if (bx > W || bx < 0 || by > H || by < 0) continue;
+        Vector2f rel(bx - me.x, by - me.y);
+        if (segmentHitsOrigin(rel + motion - Vector2f(b.dx, b.dy), rel, 30)) {
+          score -= 100 * weight;
+          return score;
+        }
+      }
+
+      for (const RockState& r : w.rocks) {
+        float rx = r.x + r.dx * t, ry = r.y + r.dy * t;
+        wrap(rx, ry);
+        Vector2f rel(rx - me.x, ry - me.y);
+        if (segmentHitsOrigin(rel + motion - Vector2f(r.dx, r.dy), rel, r.r + 20)) {
+          score -= 100 * weight;
+          return score;
+        }
+      }
+    }
+
+    // Shaping: face the nearest enemy and hold a medium range.
+    float best = -1;
+    Vector2f toEnemy;
+    for (const ShipState& e : w.ships) {
+      if (e.team == me.team) continue;
+      Vector2f d(e.x - me.x, e.y - me.y);
+      float d2 = d.x * d.x + d.y * d.y;
+      if (best < 0 || d2 < best) { best = d2; toEnemy = d; }
+    }
+    if (best > 0) {
+      float dist = sqrt(best);
+      float facing = (toEnemy.x * cos(me.angle * DEGTORAD) + toEnemy.y * sin(me.angle * DEGTORAD)) / dist;
+      score += 5 * facing - 2 * std::abs(dist - 500) / 500;
+    }
+    if (a.fire && !hit) score -= 1; // don't waste bullets
+    return score;
+  }
+
+public:
+  explicit AiPilots(ThreadPool& p) : pool(p) {
+    for (int turn = -1; turn <= 1; turn++)
+      for (int thrust = 0; thrust < 2; thrust++)
+        for (int fire = 0; fire < 2; fire++)
+          actions.push_back({ turn, thrust == 1, fire == 1 });
+  }
+
+  void plan(const std::vector<Player*>& bots, Registry& reg) {
+    if (bots.empty()) return;
+
+    auto snapshot = std::make_shared<WorldSnapshot>();
+    std::vector<EntityId> ships;
+    reg.each<Position, Motion, Ship>([&](EntityId e, Position& t, Motion& m, Ship& s) {
+      snapshot->ships.push_back({ t.x, t.y, m.dx, m.dy, t.angle, s.team, 0 });
+      ships.push_back(e);
+    });
+    reg.each<Position, Bullet>([&](EntityId, Position& t, Bullet& b) {
+      float bdx = cos(t.angle * DEGTORAD) * 30, bdy = sin(t.angle * DEGTORAD) * 30;
+      snapshot->bullets.push_back({ t.x, t.y, bdx, bdy, b.team });
+    });
+    reg.each<Position, Motion, Collider, Rock>([&](EntityId, Position& t, Motion& m, Collider& c, Rock& r) {
+      if (r.active) snapshot->rocks.push_back({ t.x, t.y, m.dx, m.dy, c.r });
+    });
+
+    shipIndex.clear();
+    for (auto b : bots) {
+      int i = int(std::find(ships.begin(), ships.end(), b->ship) - ships.begin());
+      snapshot->ships[i].bullets = b->bullets;
+      shipIndex.push_back(i);
+    }
+    std::shared_ptr<const WorldSnapshot> world = snapshot;
+
+    int count = int(bots.size() * actions.size());
+    scores.assign(count, 0);
+    pool.parallelFor(count, [&](int i) {
+      PROFILE_ZONE("rollout");
+      int bot = i / int(actions.size());
+      scores[i] = rollout(*world, shipIndex[bot], actions[i % actions.size()]);
+    });
+
+    for (size_t bot = 0; bot < bots.size(); bot++) {
+      size_t best = 0;
+      for (size_t a = 1; a < actions.size(); a++)
+        if (scores[bot * actions.size() + a] > scores[bot * actions.size() + best]) best = a;
+
+      Player* p = bots[bot];
+      const PilotAction& a = actions[best];
+      bool fire = false;
+      if (p->aiFireDelay > 0) p->aiFireDelay--;
+      else if (a.fire || p->bullets == 0) {
+        // With no bullets left, pressing fire is what starts the recharge.
+        fire = true;
+        p->aiFireDelay = p->bullets == 0 ? 30 : 8;
+      }
+      p->control(a.turn, a.thrust, fire);
+    }
+  }
+};
+
 int main()
 {
   srand(time(0));
@@ -301,184 +971,385 @@ int main()
     printf("%i ", rand()%H);
   }
 
+  // Everything below reads from asteroids.pak when it exists (see pack.bat),
+  // otherwise from the loose files.
+  AssetPack::mounted().open("asteroids.pak");
+
   Music music;
-  if (!music.openFromFile("sounds/spacemusic1.ogg"))
+  if (!openFromPack(music, "sounds/spacemusic1.ogg"))
     return 1;
   music.setLoop(true);
   music.play();
 
-  Font font;
-  if (!font.loadFromFile("fonts/sansation.ttf")) {
-    return 1;
-  }
-  Font scoreFont;
-  if (!scoreFont.loadFromFile("fonts/Death Star.otf")) {
+  Clock startClock;
+  Resources& res = Resources::get();
+
+  // Fonts are needed by the loading screen itself and only open the file.
+  auto font = res.fonts.acquire("fonts/sansation.ttf");
+  auto scoreFont = res.fonts.acquire("fonts/Death Star.otf");
+  if (!font || !scoreFont)
     return 1;
-  }
 
-  SoundBuffer bufferBlue, bufferGreen, bufferExplosion, bufferRecharge;
-  if (!bufferBlue.loadFromFile("sounds/laser2.wav"))
-      return 1;
-  if (!bufferGreen.loadFromFile("sounds/laser1.wav"))
-      return 1;
-  if (!bufferExplosion.loadFromFile("sounds/explosion1.wav"))
-      return 1;
-  if (!bufferRecharge.loadFromFile("sounds/recharge.wav"))
+  // The window takes the desktop resolution; the scene is always laid out in
+  // W x H world units and scaled to fit, with bars, by DynamicResolution.
+  RenderWindow window(VideoMode::getDesktopMode(), "Asteroids!",  Style::Fullscreen);// Style::Resize);//,
+  window.setFramerateLimit(60);
+  window.setView(letterboxView(window.getSize()));
+
+  // Everything else decodes on worker threads while the loading screen runs.
+  std::unique_ptr<AssetLoader> loader(new AssetLoader());
+  loader->texture("images/explosions/type_B.png");
+  loader->texture("images/blueship.png", true);
+  loader->texture("images/bulletBlue.png");
+  loader->texture("images/greenship.png", true);
+  loader->texture("images/bulletGreen.png");
+  loader->texture("images/rock.png", true);
+  loader->texture("images/rock_small.png", true);
+  loader->texture("images/explosions/type_C.png");
+  if (!proceduralStars) loader->texture("images/stars2.jpg", true);
+  loader->sound("sounds/laser2.wav");
+  loader->sound("sounds/laser1.wav");
+  loader->sound("sounds/explosion1.wav");
+  loader->sound("sounds/recharge.wav");
+
+  Starfield starfield;
+  if (proceduralStars) starfield.create(rand());
+
+  Text loadingText("Loading", *font, 40);
+  loadingText.setPosition(W / 2 - 70, H / 2 - 80);
+  RectangleShape barBack(Vector2f(W / 3, 16));
+  barBack.setPosition(W / 3, H / 2);
+  barBack.setFillColor(Color(60, 60, 60));
+  RectangleShape bar(barBack);
+  bar.setFillColor(Color::White);
+
+  while (!loader->update(milliseconds(8))) {
+    Event e;
+    while (window.pollEvent(e)) {
+      if (e.type == Event::Closed) return 0;
+      if (e.type == Event::KeyPressed && e.key.code == Keyboard::Escape) return 0;
+    }
+    bar.setSize(Vector2f(barBack.getSize().x * loader->progress(), barBack.getSize().y));
+    window.clear();
+    if (proceduralStars) starfield.draw(window);
+    window.draw(loadingText);
+    window.draw(barBack);
+    window.draw(bar);
+    window.display();
+  }
+  for (auto& path : loader->failed) printf("failed to load %s\n", path.c_str());
+  printf("assets loaded in %.0f ms\n", startClock.getElapsedTime().asSeconds() * 1000);
+
+  // All of these are cache hits now.
+  auto bufferBlue = res.sounds.acquire("sounds/laser2.wav");
+  auto bufferGreen = res.sounds.acquire("sounds/laser1.wav");
+  auto bufferExplosion = res.sounds.acquire("sounds/explosion1.wav");
+  auto bufferRecharge = res.sounds.acquire("sounds/recharge.wav");
+  if (!bufferBlue || !bufferGreen || !bufferExplosion || !bufferRecharge)
       return 1;
 
-  Sound laserSoundBlue(bufferBlue);
-  Sound laserSoundGreen(bufferGreen);
-  Sound explosionSound(bufferExplosion);
-  Sound rechargeSound(bufferRecharge);
+  Sound explosionSound(*bufferExplosion);
 
-  RenderWindow window(VideoMode(W, H), "Asteroids!",  Style::Fullscreen);// Style::Resize);//,
-  window.setFramerateLimit(60);
+  DynamicResolution resolution;
+  if (!resolution.create())
+    return 1;
+
+  std::shared_ptr<Texture> tBackground;
+  Sprite sBackground;
+  if (!proceduralStars) {
+    tBackground = res.textures.acquire("images/stars2.jpg");
+    if (tBackground) sBackground.setTexture(*tBackground);
+  }
 
-  Texture tBackground;
-  tBackground.loadFromFile("images/stars2.jpg");
-  tBackground.setSmooth(true);
-  Sprite sBackground(tBackground);
-
-  Texture tExplosionShip;
-  tExplosionShip.loadFromFile("images/explosions/type_B.png");
-  Animation sExplosionShip(tExplosionShip, 0,0,192,192, 64, 0.5);
-
-  Texture tPlayerBlue, tBulletBlue;
-  tPlayerBlue.loadFromFile("images/blueship.png");
-  tPlayerBlue.setSmooth(true);
-  Animation sPlayerBlue(tPlayerBlue, 40, 0, 40, 40, 1, 0);
-  Animation sPlayerBlueGo(tPlayerBlue, 40,40,40,40, 1, 0);
-  tBulletBlue.loadFromFile("images/bulletBlue.png");
-  Animation sBulletBlue(tBulletBlue, 0, 0, 32, 64, 16, 0.8);
-
-  Texture tPlayerGreen, tBulletGreen;
-  tPlayerGreen.loadFromFile("images/greenship.png");
-  tPlayerGreen.setSmooth(true);
-  Animation sPlayerGreen(tPlayerGreen, 40, 0, 40, 40, 1, 0);
-  Animation sPlayerGreenGo(tPlayerGreen, 40, 40, 40, 40, 1, 0);
-  tBulletGreen.loadFromFile("images/bulletGreen.png");
-  Animation sBulletGreen(tBulletGreen, 0, 0, 32, 64, 16, 0.8);
-
-  std::list<Entity*> entities;
-
-  Player* playerBlue = new Player("Blue", sPlayerBlueGo, sBulletBlue, laserSoundBlue, rechargeSound, entities);
-  playerBlue->settings(sPlayerBlue, 20, H/2, 0, 20);
-  entities.push_back(playerBlue);
+  auto tExplosionShip = res.textures.acquire("images/explosions/type_B.png");
+  auto tPlayerBlue = res.textures.acquire("images/blueship.png");
+  auto tBulletBlue = res.textures.acquire("images/bulletBlue.png");
+  auto tPlayerGreen = res.textures.acquire("images/greenship.png");
+  auto tBulletGreen = res.textures.acquire("images/bulletGreen.png");
+  auto tRock = res.textures.acquire("images/rock.png");
+  auto tRockSmall = res.textures.acquire("images/rock_small.png");
+  auto tExplosionRock = res.textures.acquire("images/explosions/type_C.png");
+  if (!tExplosionShip || !tPlayerBlue || !tBulletBlue || !tPlayerGreen || !tBulletGreen ||
+      !tRock || !tRockSmall || !tExplosionRock)
+    return 1;
+  loader.reset();
+
+  Animation sExplosionShip(*tExplosionShip, 0,0,192,192, 64, 0.5);
+
+  Animation sPlayerBlue(*tPlayerBlue, 40, 0, 40, 40, 1, 0);
+  Animation sPlayerBlueGo(*tPlayerBlue, 40,40,40,40, 1, 0);
+  Animation sBulletBlue(*tBulletBlue, 0, 0, 32, 64, 16, 0.8);
+
+  Animation sPlayerGreen(*tPlayerGreen, 40, 0, 40, 40, 1, 0);
+  Animation sPlayerGreenGo(*tPlayerGreen, 40, 40, 40, 40, 1, 0);
+  Animation sBulletGreen(*tBulletGreen, 0, 0, 32, 64, 16, 0.8);
+
+  Registry reg;
+  ThreadPool pool;
+  std::vector<Player*> players;
+
+  // Slots 0 and 1 follow joysticks 0 and 1 and fall back to AI when no pad is
+  // connected; the extra bots are always AI.
+  auto addPlayer = [&](bool blue, float x, float y) {
+    Player* p = blue ?
+      new Player("Blue", sBulletBlue, bufferBlue, bufferRecharge) :
+      new Player("Green", sBulletGreen, bufferGreen, bufferRecharge);
+    p->ship = blue ?
+      spawnShip(reg, int(players.size()), 0, sPlayerBlue, sPlayerBlueGo, x, y, 0) :
+      spawnShip(reg, int(players.size()), 1, sPlayerGreen, sPlayerGreenGo, x, y, -180);
+    players.push_back(p);
+    return p;
+  };
+
+  Player* playerBlue = addPlayer(true, 20, H/2);
   Debug blueDebug(font, 20, 20);
+  Player* playerGreen = addPlayer(false, W-20, H/2);
+  for (int i = 0; i < botsPerTeam * 2; i++)
+    addPlayer(i % 2 == 0, rand()%W, rand()%H)->ai = true;
 
-  Player* playerGreen = new Player("Green", sPlayerGreenGo, sBulletGreen, laserSoundGreen, rechargeSound, entities);
-  playerGreen->settings(sPlayerGreen, W-20, H/2, -180, 20);
-  entities.push_back(playerGreen);
+  AsteroidField field(reg, *tRock, *tRockSmall, *tExplosionRock);
 
-  Player* players[4];
-  players[0] = playerBlue;
-  players[1] = playerGreen;
+  AiPilots pilots(pool);
+  std::vector<Player*> bots;
+  int frame = 0;
 
   Score score(scoreFont);
+  res.report();
+
+  // Per-tick simulation. Systems that declare their components run on the
+  // pool next to any neighbours they don't conflict with (bullets and
+  // animation here); the others run alone on this thread.
+  Systems systems(reg, pool);
+
+  // Per-tick buffers, kept across ticks so a burst of hits doesn't allocate.
+  std::vector<Collidable> ships, shots, rocks;
+  std::vector<char> hit, respawn, shotUsed, rockBroken;
+  std::vector<int> rammed, crashed, rockHitBy;
+
+  systems.add("collision", [&] {
+    ships.clear(); shots.clear(); rocks.clear();
+    reg.each<Position, Motion, Collider, Ship>([&](EntityId e, Position& t, Motion& m, Collider& c, Ship& s) {
+      ships.push_back({ e, t.x, t.y, m.px, m.py, c.r, s.team });
+    });
+    reg.each<Position, Motion, Collider, Bullet>([&](EntityId e, Position& t, Motion& m, Collider& c, Bullet& b) {
+      shots.push_back({ e, t.x, t.y, m.px, m.py, c.r, b.team });
+    });
+    field.collidables(rocks);
+
+    // Detection in parallel, one ship or rock per item; each item only
+    // writes its own slot. Ship pairs are tested once, from the green side.
+    hit.assign(ships.size(), 0);
+    rammed.assign(ships.size(), -1);
+    crashed.assign(ships.size(), -1);
+    pool.parallelFor(int(ships.size()), [&](int i) {
+      const Collidable& a = ships[i];
+      for (const Collidable& b : shots)
+        if (b.team != a.team && isSweptCollide(a, b)) { hit[i] = 1; break; }
+      for (size_t k = 0; k < rocks.size(); k++)
+        if (isSweptCollide(a, rocks[k])) { crashed[i] = int(k); break; }
+      if (a.team != 1) return;
+      for (size_t j = 0; j < ships.size(); j++)
+        if (ships[j].team == 0 && isSweptCollide(a, ships[j])) { rammed[i] = int(j); break; }
+    });
+    rockHitBy.assign(rocks.size(), -1);
+    pool.parallelFor(int(rocks.size()), [&](int i) {
+      for (size_t j = 0; j < shots.size(); j++)
+        if (isSweptCollide(rocks[i], shots[j])) { rockHitBy[i] = int(j); break; }
+    });
+
+    // A bullet breaks the first rock it hits and is used up. Broken rocks
+    // are only marked here: destroy() returns a rock to its pool and spawns
+    // children from the pools, so destroying mid-pass could hand a slot in
+    // rocks[] to a fresh child that a later hit would then break.
+    shotUsed.assign(shots.size(), 0);
+    rockBroken.assign(rocks.size(), 0);
+    for (size_t i = 0; i < rocks.size(); i++) {
+      int j = rockHitBy[i];
+      if (j < 0 || shotUsed[j]) continue;
+      shotUsed[j] = 1;
+      reg.destroy(shots[j].id);
+      rockBroken[i] = 1;
+    }
 
-  while (window.isOpen()) {
-    Event e;
-    while (window.pollEvent(e)) {
-      if (e.type == Event::Closed) {
-        window.close();
+    respawn.assign(ships.size(), 0);
+    for (size_t i = 0; i < ships.size(); i++) {
+      if (hit[i]) respawn[i] = 1;
+      if (rammed[i] >= 0) respawn[i] = respawn[rammed[i]] = 1;
+      if (crashed[i] >= 0) {
+        respawn[i] = 1;
+        rockBroken[crashed[i]] = 1;
       }
+    }
+    for (size_t i = 0; i < rocks.size(); i++)
+      if (rockBroken[i]) field.destroy(rocks[i].id);
+    for (size_t i = 0; i < ships.size(); i++) {
+      if (!respawn[i]) continue;
+      explosionSound.play();
+      spawnExplosion(reg, sExplosionShip, ships[i].x, ships[i].y);
+
+      float x = rand()%W, y = rand()%H;
+      reg.get<Position>(ships[i].id) = Position{ x, y, 0 };
+      reg.get<Motion>(ships[i].id) = Motion{ 0, 0, x, y };
+      players[reg.get<Ship>(ships[i].id).player]->score--;
+      score.updateBlue(playerBlue->score, playerBlue->bullets);
+      score.updateGreen(playerGreen->score, playerGreen->bullets);
+    }
+  });
+
+  systems.add("waves", [&] {
+    field.update();
+  });
+
+  systems.add("controls", [&] {
+    for (auto p : players) p->update(reg);
+  });
+
+  systems.add("bullets", [&] {
+    reg.parallelEach<Position, Motion, Bullet>(pool, [&](EntityId e, Position& t, Motion& m, Bullet&) {
+      if (!stepBullet(t, m)) reg.destroyLater(e);
+    });
+  }).writes<Position, Motion>().reads<Bullet>();
+
+  systems.add("animation", [&] {
+    reg.parallelEach<Animation>(pool, [](EntityId, Animation& a) {
+      a.update();
+    });
+    reg.each<Animation, Explosion>([&](EntityId e, Animation& a, Explosion&) {
+      if (a.isEnd()) reg.destroyLater(e);
+    });
+  }).writes<Animation>().reads<Explosion>();
+
+  // After animation, so the thrust frame isn't overwritten.
+  systems.add("ships", [&] {
+    reg.parallelEach<Position, Motion, Animation, Controls, ShipFrames>(pool,
+      [](EntityId, Position& t, Motion& m, Animation& a, Controls& c, ShipFrames& f) {
+        stepShip(t, m, c);
+        a.sprite.setTextureRect(c.thrust ? f.go : f.quiet);
+      });
+  }).writes<Position, Motion, Animation>().reads<Controls, ShipFrames>();
+
+  systems.add("rocks", [&] {
+    field.step(pool);
+  }).writes<Position, Motion, Rock>();
+
+  // From here on the window's events are polled through the sampler, which
+  // reads the joysticks on its own thread; see InputSampler.hpp.
+  InputSampler input;
+  input.start(1000);
+
+  Profiler::get().setThreadName("main");
+  ProfilerOverlay overlay(*font); // F3 toggles, F4 writes trace.json
+
+  // F5 starts and stops recording to capture/frame_NNNNNN.png at 1080p.
+  FrameCapture capture;
+  if (!capture.create(W * 1080 / H, 1080, View(FloatRect(0, 0, W, H))))
+    return 1;
+  Text recText("", *font, 30);
+  recText.setFillColor(Color::Red);
+  recText.setPosition(W / 2 - 250, 20);
 
-      if (e.type == Event::KeyPressed) {
+  while (window.isOpen()) {
+    resolution.startFrame();
+    {
+      PROFILE_ZONE("events");
+      Event e;
+      while (input.pollEvent(window, e)) {
+        if (e.type == Event::Closed) {
+          window.close();
+        }
 
-        if (e.key.code == Keyboard::Escape) exit(0);
-      }
+        if (e.type == Event::KeyPressed) {
 
-      else if ((e.type == Event::JoystickButtonPressed) ||
-        (e.type == Event::JoystickButtonReleased) ||
-        (e.type == Event::JoystickMoved) ||
-        (e.type == Event::JoystickConnected)) {
+          if (e.key.code == Keyboard::Escape) {
+            capture.finish();
+            exit(0);
+          }
 
-        // Update displayed joystick values
-        int id = e.joystickConnect.joystickId;
-        players[id]->joystick(id);
-        score.updateBlue(playerBlue->score, playerBlue->bullets);
-        score.updateGreen(playerGreen->score, playerGreen->bullets);     
-      }
+          if (e.key.code == Keyboard::F3) {
+            overlay.visible = !overlay.visible;
+            Profiler::get().enabled = overlay.visible;
+          }
+          if (e.key.code == Keyboard::F4) {
+            Profiler::get().exportChromeTrace("trace.json");
+          }
+          if (e.key.code == Keyboard::F5) {
+            if (capture.recording) capture.stop();
+            else capture.start("capture");
+            // Full resolution in the recording, whatever it costs.
+            resolution.enabled = !capture.recording;
+          }
+        }
 
-      else if (e.type == Event::JoystickDisconnected)
-      {
-        ;
       }
 
+      // Joysticks are sampled on the input thread; drain everything queued
+      // since the last tick.
+      InputEvent ie;
+      while (input.poll(ie)) {
+        if (ie.joystick >= 2 || ie.type == InputEvent::KeyPressed || ie.type == InputEvent::KeyReleased)
+          continue;
+        players[ie.joystick]->joystick(ie);
+        score.updateBlue(playerBlue->score, playerBlue->bullets);
+        score.updateGreen(playerGreen->score, playerGreen->bullets);
+      }
+      blueDebug.updateLatency(input);
     }
 
-    for(auto e:entities)
-     if (e->name=="explosion")
-      if (e->anim.isEnd()) e->life=0;
-
-    for (auto a : entities) {
-      for (auto b : entities) {
-        if (a->name == "Green" && b->name == "bulletBlue" ||
-            a->name == "Blue" && b->name == "bulletGreen") {
-
-          if (isCollide(a,b)) {
-            explosionSound.play();
-            Entity* e = new Entity();
-            e->settings(sExplosionShip, a->x, a->y);
-            e->name = "explosion";
-            entities.push_back(e);
-
-            a->settings(a->animQuiet, rand()%W, rand()%H, 0, 20);
-            a->dx = 0; a->dy = 0;
-            ((Player*)a)->score--;
-            score.updateBlue(playerBlue->score, playerBlue->bullets);
-            score.updateGreen(playerGreen->score, playerGreen->bullets);          
-          }
-        }
-        if (a->name == "Green" && b->name == "Blue") {
-          if (isCollide(a,b)) {
-            explosionSound.play();
-            Entity* e = new Entity();
-            e->settings(sExplosionShip, a->x, a->y);
-            e->name = "explosion";
-            entities.push_back(e);
-
-            explosionSound.play();
-            e = new Entity();
-            e->settings(sExplosionShip, b->x, b->y);
-            e->name = "explosion";
-            entities.push_back(e);
-
-            a->settings(a->animQuiet, rand()%W, rand()%H, 0, 20);
-            a->dx = 0; a->dy = 0;
-            ((Player*)a)->score--;
-            b->settings(b->animQuiet, rand()%W, rand()%H, 0, 20);
-            b->dx = 0; b->dy = 0;
-            ((Player*)b)->score--;            
-            score.updateBlue(playerBlue->score, playerBlue->bullets);
-            score.updateGreen(playerGreen->score, playerGreen->bullets);                 
-          }
+    {
+      PROFILE_ZONE("ai");
+      // Plan at 30 Hz; the chosen inputs are held for the frame in between.
+      if (frame++ % 2 == 0) {
+        bots.clear();
+        for (size_t i = 0; i < players.size(); i++) {
+          if (i < 2) players[i]->ai = !input.isConnected(i);
+          if (players[i]->ai) bots.push_back(players[i]);
         }
+        pilots.plan(bots, reg);
       }
     }
 
-    for (auto i = entities.begin(); i != entities.end();) {
-      Entity* e = *i;
-      e->update();
-      e->anim.update();
+    {
+      PROFILE_ZONE("update");
+      systems.run();
 
-      if (e->life == false) { i = entities.erase(i); delete e; }
-      else i++;
+      // The camera is fixed, so parallax follows the ships' mean motion.
+      Motion& blue = reg.get<Motion>(playerBlue->ship);
+      Motion& green = reg.get<Motion>(playerGreen->ship);
+      starfield.scroll((blue.dx + green.dx) * 0.5f, (blue.dy + green.dy) * 0.5f);
     }
 
     blueDebug.update(playerBlue->jx, playerBlue->jy, playerBlue->buttonA);
 
-    // draw
-    window.clear();
-    window.draw(sBackground);
-
-    for (auto e : entities) {
-      e->draw(window);
+    {
+      PROFILE_ZONE("draw");
+      // draw
+      RenderTarget& scene = resolution.begin();
+      if (proceduralStars) starfield.draw(scene);
+      else scene.draw(sBackground);
+      field.draw(scene);
+
+      reg.each<Position, Animation>([&](EntityId, Position& t, Animation& a) {
+        a.sprite.setPosition(t.x, t.y);
+        a.sprite.setRotation(t.angle + 90);
+        scene.draw(a.sprite);
+      });
+      // While recording, the frame is composed offscreen and copied to the
+      // window by the capture; the indicator and profiler stay out of it.
+      RenderTarget& frameTarget = capture.recording ? capture.begin() : static_cast<RenderTarget&>(window);
+      resolution.present(frameTarget);
+
+      score.draw(frameTarget);
+      if (capture.recording) {
+        capture.end(window);
+        recText.setString(capture.status());
+        window.draw(recText);
+      }
+      blueDebug.draw(window);
+      overlay.draw(window, 20, H - 260, 1400);
     }
-    //blueDebug.draw(window);
-
-    score.draw(window);
+    resolution.update();
     window.display();
+    Profiler::get().frameMark();
   }
 
   return 0;
@@ -0,0 +1 @@
+..\tools\packer\packer.exe asteroids.pak -c --raw images/blueship.png --raw images/greenship.png --raw images/bulletBlue.png --raw images/bulletGreen.png --raw images/explosions/type_B.png --raw images/explosions/type_C.png --raw images/rock.png --raw images/rock_small.png images/stars2.jpg images/explosions/type_B.png images/explosions/type_C.png images/rock.png images/rock_small.png images/blueship.png images/greenship.png images/bulletBlue.png images/bulletGreen.png sounds/laser1.wav sounds/laser2.wav sounds/explosion1.wav sounds/recharge.wav sounds/spacemusic1.ogg fonts
\ No newline at end of file
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <SFML/Graphics.hpp>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ResourceCache.hpp"
+#include "ThreadPool.hpp"
+
+// Loads textures and sound buffers in the background. Image and audio
+// decoding runs on a worker pool in parallel; the main thread only does the
+// GPU uploads (and the OpenAL buffer fills), a few per frame under a time
+// budget, so a loading screen keeps animating. Finished assets go into the
+// Resources caches, where a later acquire() of the same path is a hit.
+// Paths are looked up in the mounted AssetPack first.
+//
+//   AssetLoader loader;
+//   loader.texture("images/ship.png", true);
+//   loader.sound("sounds/laser.wav");
+//   while (!loader.update(sf::milliseconds(8))) drawProgress(loader.progress());
+class AssetLoader
+{
+  struct Job {
+    std::string path;
+    bool isTexture;
+    bool direct = false; // raw RGBA in the pack: upload straight from the mapping
+    bool smooth;
+    bool ok = false;
+    sf::Image image;
+    std::vector<sf::Int16> samples;
+    unsigned channels = 0, sampleRate = 0;
+  };
+
+  ThreadPool pool;
+  std::mutex mutex;
+  std::vector<std::shared_ptr<Job>> decoded;
+  int queued = 0;
+  int finished = 0;
+
+  // Strong references until the loader goes away, since the caches only
+  // hold weak ones.
+  std::vector<std::shared_ptr<sf::Texture>> textures;
+  std::vector<std::shared_ptr<sf::SoundBuffer>> buffers;
+
+  void enqueue(std::shared_ptr<Job> job) {
+    queued++;
+    pool.push([this, job] {
+      if (job->isTexture) {
+        job->ok = loadFromPack(job->image, job->path);
+      } else {
+        std::vector<uint8_t> scratch;
+        sf::InputSoundFile file;
+        if (loadFromPack(file, job->path, scratch)) {
+          job->samples.resize(size_t(file.getSampleCount()));
+          job->channels = file.getChannelCount();
+          job->sampleRate = file.getSampleRate();
+          job->ok = file.read(job->samples.data(), job->samples.size()) == job->samples.size();
+        }
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      decoded.push_back(job);
+    });
+  }
+
+  void upload(Job& job) {
+    Resources& res = Resources::get();
+    if (job.isTexture) {
+      auto t = std::make_shared<sf::Texture>();
+      if (job.direct ? loadFromPack(*t, job.path) : t->loadFromImage(job.image)) {
+        t->setSmooth(job.smooth);
+        textures.push_back(res.textures.insert(job.path, t));
+      } else {
+        failed.push_back(job.path);
+      }
+    } else {
+      auto b = std::make_shared<sf::SoundBuffer>();
+      if (b->loadFromSamples(job.samples.data(), job.samples.size(), job.channels, job.sampleRate))
+        buffers.push_back(res.sounds.insert(job.path, b));
+      else
+        failed.push_back(job.path);
+    }
+  }
+
+public:
+  std::vector<std::string> failed;
+
+  ~AssetLoader() { pool.wait(); }
+
+  void texture(const std::string& path, bool smooth = false) {
+    auto job = std::make_shared<Job>();
+    job->path = path;
+    job->isTexture = true;
+    job->smooth = smooth;
+
+    const PackEntry* e = AssetPack::mounted().find(path);
+    if (e && e->flags == PackRGBA) {
+      // Nothing to decode; the upload reads the mapped pixels directly.
+      job->direct = true;
+      job->ok = true;
+      queued++;
+      std::lock_guard<std::mutex> lock(mutex);
+      decoded.push_back(job);
+      return;
+    }
+    enqueue(job);
+  }
+
+  void sound(const std::string& path) {
+    auto job = std::make_shared<Job>();
+    job->path = path;
+    job->isTexture = false;
+    enqueue(job);
+  }
+
+  // Main thread, once per frame: uploads decoded assets until the budget is
+  // spent. Returns true once everything queued is resident (or failed).
+  bool update(sf::Time budget) {
+    sf::Clock clock;
+    while (finished < queued && clock.getElapsedTime() < budget) {
+      std::shared_ptr<Job> job;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (decoded.empty()) break;
+        job = decoded.back();
+        decoded.pop_back();
+      }
+      if (job->ok) upload(*job);
+      else failed.push_back(job->path);
+      finished++;
+    }
+    return finished == queued;
+  }
+
+  float progress() const { return queued ? float(finished) / queued : 1.0f; }
+};
@@ -0,0 +1,353 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <SFML/Graphics.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Single-file asset archive, written by tools/packer and read through a
+// memory mapping.
+//
+//   PackHeader | PackEntry[count], sorted by path | entry data...
+//
+// Every entry starts on a 64-byte boundary. Entries may be LZ4 block
+// compressed, and textures may be stored pre-decoded as raw RGBA so they go
+// straight from the mapping to the GPU. Uncompressed entries are handed to
+// SFML's loadFromMemory without any copy.
+
+const char packMagic[8] = { 'S', 'F', 'P', 'A', 'C', 'K', '1', 0 };
+const uint32_t packAlignment = 64;
+
+enum PackFlags
+{
+  PackCompressed = 1, // LZ4 block; rawSize is the decompressed size
+  PackRGBA = 2,       // width * height * 4 bytes of pixels, not an image file
+};
+
+struct PackHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t entryCount;
+  uint64_t dataOffset;
+  uint8_t reserved[40];
+};
+
+struct PackEntry
+{
+  char path[88];
+  uint64_t offset; // from the start of the file
+  uint64_t size;   // stored bytes
+  uint64_t rawSize;
+  uint32_t flags;
+  uint32_t width, height;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(PackHeader) == 64, "PackHeader must stay 64 bytes");
+static_assert(sizeof(PackEntry) == 128, "PackEntry must stay 128 bytes");
+
+// Decodes an LZ4 block. Returns false on malformed input or if the output
+// isn't exactly dstSize bytes.
+inline bool lz4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+  const uint8_t* ip = src;
+  const uint8_t* iend = src + srcSize;
+  uint8_t* op = dst;
+  uint8_t* oend = dst + dstSize;
+
+  while (ip < iend) {
+    unsigned token = *ip++;
+
+    size_t literals = token >> 4;
+    if (literals == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend) return false;
+        b = *ip++;
+        literals += b;
+      } while (b == 255);
+    }
+    if (size_t(iend - ip) < literals || size_t(oend - op) < literals) return false;
+    memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == iend) break; // the last sequence has no match
+
+    if (iend - ip < 2) return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > size_t(op - dst)) return false;
+
+    size_t length = token & 15;
+    if (length == 15) {
+      uint8_t b;
+      do {
+        if (ip >= iend) return false;
+        b = *ip++;
+        length += b;
+      } while (b == 255);
+    }
+    length += 4;
+    if (size_t(oend - op) < length) return false;
+
+    // Matches may overlap their own output, so copy forward byte by byte.
+    const uint8_t* match = op - offset;
+    for (size_t i = 0; i < length; i++) op[i] = match[i];
+    op += length;
+  }
+  return op == oend;
+}
+
+class MappedFile
+{
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = NULL;
+#endif
+  const uint8_t* bytes = nullptr;
+  size_t length = 0;
+
+public:
+  MappedFile() {}
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool open(const std::string& path) {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) { close(); return false; }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) { close(); return false; }
+    bytes = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!bytes) { close(); return false; }
+    length = size_t(size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+    void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+    bytes = (const uint8_t*)p;
+    length = size_t(st.st_size);
+#endif
+    return true;
+  }
+
+  void close() {
+#ifdef _WIN32
+    if (bytes) UnmapViewOfFile(bytes);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    mapping = NULL;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (bytes) munmap((void*)bytes, length);
+#endif
+    bytes = nullptr;
+    length = 0;
+  }
+
+  const uint8_t* data() const { return bytes; }
+  size_t size() const { return length; }
+};
+
+class AssetPack
+{
+  MappedFile file;
+  const PackHeader* header = nullptr;
+  const PackEntry* index = nullptr;
+  // Decompressed copies that SFML keeps pointing at (fonts, music), one per
+  // entry however often it is loaded.
+  std::map<const PackEntry*, std::vector<uint8_t>> pinned;
+
+public:
+  // The pack the games' loaders consult before falling back to loose files.
+  static AssetPack& mounted() {
+    static AssetPack pack;
+    return pack;
+  }
+
+  bool open(const std::string& path) {
+    close();
+    if (!file.open(path)) return false;
+    header = (const PackHeader*)file.data();
+    if (file.size() < sizeof(PackHeader) || memcmp(header->magic, packMagic, 8) != 0 ||
+        header->version != 1 ||
+        file.size() < sizeof(PackHeader) + size_t(header->entryCount) * sizeof(PackEntry)) {
+      close();
+      return false;
+    }
+    index = (const PackEntry*)(file.data() + sizeof(PackHeader));
+    for (uint32_t i = 0; i < header->entryCount; i++) {
+      if (index[i].offset + index[i].size > file.size()) { close(); return false; }
+    }
+    return true;
+  }
+
+  void close() {
+    file.close();
+    header = nullptr;
+    index = nullptr;
+    pinned.clear();
+  }
+
+  bool isOpen() const { return header != nullptr; }
+  uint32_t count() const { return header ? header->entryCount : 0; }
+  const PackEntry& entry(uint32_t i) const { return index[i]; }
+
+  const PackEntry* find(const std::string& path) const {
+    if (!header) return nullptr;
+    const PackEntry* end = index + header->entryCount;
+    const PackEntry* e = std::lower_bound(index, end, path,
+      [](const PackEntry& a, const std::string& p) { return strncmp(a.path, p.c_str(), sizeof(a.path)) < 0; });
+    if (e == end || strncmp(e->path, path.c_str(), sizeof(e->path)) != 0) return nullptr;
+    return e;
+  }
+
+  // Points data at the entry's bytes: straight into the mapping when stored
+  // uncompressed, otherwise decompressed into scratch.
+  bool read(const PackEntry& e, const uint8_t*& data, size_t& size, std::vector<uint8_t>& scratch) const {
+    const uint8_t* stored = file.data() + e.offset;
+    if (!(e.flags & PackCompressed)) {
+      data = stored;
+      size = size_t(e.size);
+      return true;
+    }
+    scratch.resize(size_t(e.rawSize));
+    if (!lz4Decompress(stored, size_t(e.size), scratch.data(), scratch.size())) return false;
+    data = scratch.data();
+    size = scratch.size();
+    return true;
+  }
+
+  // Like read(), for consumers that keep the pointer for their lifetime.
+  // A compressed entry is decompressed on its first pinned read only; later
+  // reads return the same copy, which lives until the pack is closed.
+  bool readPinned(const PackEntry& e, const uint8_t*& data, size_t& size) {
+    if (!(e.flags & PackCompressed)) {
+      std::vector<uint8_t> unused;
+      return read(e, data, size, unused);
+    }
+    auto it = pinned.find(&e);
+    if (it != pinned.end()) {
+      data = it->second.data();
+      size = it->second.size();
+      return true;
+    }
+    std::vector<uint8_t> copy;
+    if (!read(e, data, size, copy)) return false;
+    it = pinned.emplace(&e, std::move(copy)).first;
+    data = it->second.data();
+    return true;
+  }
+};
+
+// Pack-aware loaders: look the path up in the mounted pack, else read the
+// loose file as before.
+
+inline bool loadFromPack(sf::Image& image, const std::string& path)
+{
+  AssetPack& pack = AssetPack::mounted();
+  const PackEntry* e = pack.find(path);
+  if (!e) return image.loadFromFile(path);
+  const uint8_t* data;
+  size_t size;
+  std::vector<uint8_t> scratch;
+  if (!pack.read(*e, data, size, scratch)) return false;
+  if (e->flags & PackRGBA) {
+    if (size != size_t(e->width) * e->height * 4) return false;
+    image.create(e->width, e->height, data);
+    return true;
+  }
+  return image.loadFromMemory(data, size);
+}
+
+inline bool loadFromPack(sf::Texture& texture, const std::string& path)
+{
+  AssetPack& pack = AssetPack::mounted();
+  const PackEntry* e = pack.find(path);
+  if (!e) return texture.loadFromFile(path);
+  const uint8_t* data;
+  size_t size;
+  std::vector<uint8_t> scratch;
+  if (!pack.read(*e, data, size, scratch)) return false;
+  if (e->flags & PackRGBA) {
+    if (size != size_t(e->width) * e->height * 4) return false;
+    if (!texture.create(e->width, e->height)) return false;
+    texture.update(data);
+    return true;
+  }
+  return texture.loadFromMemory(data, size);
+}
+
+inline bool loadFromPack(sf::SoundBuffer& buffer, const std::string& path)
+{
+  AssetPack& pack = AssetPack::mounted();
+  const PackEntry* e = pack.find(path);
+  if (!e) return buffer.loadFromFile(path);
+  const uint8_t* data;
+  size_t size;
+  std::vector<uint8_t> scratch;
+  return pack.read(*e, data, size, scratch) && buffer.loadFromMemory(data, size);
+}
+
+// The file reads from scratch (if the entry is compressed) until closed, so
+// keep scratch alive alongside it. Safe to call from worker threads.
+inline bool loadFromPack(sf::InputSoundFile& file, const std::string& path, std::vector<uint8_t>& scratch)
+{
+  AssetPack& pack = AssetPack::mounted();
+  const PackEntry* e = pack.find(path);
+  if (!e) return file.openFromFile(path);
+  const uint8_t* data;
+  size_t size;
+  return pack.read(*e, data, size, scratch) && file.openFromMemory(data, size);
+}
+
+inline bool loadFromPack(sf::Font& font, const std::string& path)
+{
+  AssetPack& pack = AssetPack::mounted();
+  const PackEntry* e = pack.find(path);
+  if (!e) return font.loadFromFile(path);
+  const uint8_t* data;
+  size_t size;
+  return pack.readPinned(*e, data, size) && font.loadFromMemory(data, size);
+}
+
+inline bool openFromPack(sf::Music& music, const std::string& path)
+{
+  AssetPack& pack = AssetPack::mounted();
+  const PackEntry* e = pack.find(path);
+  if (!e) return music.openFromFile(path);
+  const uint8_t* data;
+  size_t size;
+  return pack.readPinned(*e, data, size) && music.openFromMemory(data, size);
+}
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Profiler.hpp"
+#include "ThreadPool.hpp"
+
+// Archetype-based entity-component store.
+//
+// Entities with the same set of component types share an archetype, which
+// keeps one dense array per component type. A query walks the matching
+// archetypes array by array, so the per-entity loop is plain indexing: no
+// virtual calls and no pointers to follow.
+//
+//   Registry reg;
+//   EntityId e = reg.create(Position{ 10, 20 }, Velocity{ 1, 0 });
+//   reg.add(e, Health{ 3 });
+//   reg.each<Position, Velocity>([](EntityId, Position& p, Velocity& v) { p.x += v.x; });
+//   reg.parallelEach<Position, Velocity>(pool, ...);   // chunks spread over the pool
+//
+// Adding or removing components and destroying entities moves rows between
+// arrays, so it must not happen during a query; queue it with defer() and
+// apply it with flush() afterwards. Components are any movable type with a
+// default constructor. At most 64 component types per program.
+
+struct EntityId
+{
+  uint32_t index;
+  uint32_t generation;
+
+  bool operator==(const EntityId& o) const { return index == o.index && generation == o.generation; }
+  bool operator!=(const EntityId& o) const { return !(*this == o); }
+};
+
+const EntityId noEntity = { 0xffffffffu, 0 };
+
+typedef uint64_t ComponentMask;
+
+inline int nextComponentId()
+{
+  static int next = 0;
+  return next++;
+}
+
+template <typename T>
+int componentId()
+{
+  static const int id = nextComponentId();
+  return id;
+}
+
+template <typename... C>
+ComponentMask componentMask()
+{
+  ComponentMask m = 0;
+  int ids[] = { 0, (m |= ComponentMask(1) << componentId<C>(), 0)... };
+  (void)ids;
+  return m;
+}
+
+class ColumnBase
+{
+public:
+  virtual ~ColumnBase() {}
+  virtual ColumnBase* emptyCopy() const = 0;
+  virtual void pushDefault() = 0;
+  virtual void pushFrom(ColumnBase& src, size_t row) = 0; // moves src[row] to the end
+  virtual void swapRemove(size_t row) = 0;
+  virtual void reserve(size_t n) = 0;
+};
+
+template <typename T>
+class Column : public ColumnBase
+{
+public:
+  std::vector<T> data;
+
+  ColumnBase* emptyCopy() const { return new Column<T>(); }
+  void pushDefault() { data.emplace_back(); }
+  void pushFrom(ColumnBase& src, size_t row) { data.push_back(std::move(static_cast<Column<T>&>(src).data[row])); }
+  void swapRemove(size_t row) {
+    if (row + 1 != data.size()) data[row] = std::move(data.back());
+    data.pop_back();
+  }
+  void reserve(size_t n) { data.reserve(n); }
+};
+
+class Archetype
+{
+public:
+  ComponentMask mask;
+  std::vector<EntityId> entities;
+  std::unique_ptr<ColumnBase> columns[64];
+
+  size_t size() const { return entities.size(); }
+
+  template <typename T>
+  std::vector<T>& column() { return static_cast<Column<T>*>(columns[componentId<T>()].get())->data; }
+};
+
+class Registry
+{
+  struct Record {
+    Archetype* archetype = nullptr;
+    size_t row = 0;
+    uint32_t generation = 0;
+  };
+
+  std::vector<Record> records;
+  std::vector<uint32_t> freeIndices;
+  std::unordered_map<ComponentMask, std::unique_ptr<Archetype>> byMask;
+  std::vector<Archetype*> archetypes;
+
+  std::mutex deferredMutex;
+  std::vector<std::function<void(Registry&)>> deferred;
+
+  Archetype& archetype(ComponentMask mask, const Archetype* like, ColumnBase* extra, int extraId) {
+    auto& slot = byMask[mask];
+    if (!slot) {
+      slot.reset(new Archetype());
+      slot->mask = mask;
+      for (int i = 0; i < 64; i++)
+        if (like && like->columns[i] && (mask >> i & 1)) slot->columns[i].reset(like->columns[i]->emptyCopy());
+      if (extra) slot->columns[extraId].reset(extra->emptyCopy());
+      archetypes.push_back(slot.get());
+    }
+    return *slot;
+  }
+
+  // Moves an entity's row to the archetype for newMask, keeping the
+  // components both have. New columns get a default value.
+  void move(EntityId e, ComponentMask newMask, ColumnBase* extra, int extraId) {
+    Record& r = records[e.index];
+    Archetype* from = r.archetype;
+    Archetype& to = archetype(newMask, from, extra, extraId);
+    if (&to == from) return;
+
+    for (int i = 0; i < 64; i++) {
+      if (!to.columns[i]) continue;
+      if (from && from->columns[i]) to.columns[i]->pushFrom(*from->columns[i], r.row);
+      else to.columns[i]->pushDefault();
+    }
+    to.entities.push_back(e);
+    if (from) removeRow(*from, r.row);
+    r.archetype = &to;
+    r.row = to.size() - 1;
+  }
+
+  template <typename... C>
+  Archetype& archetypeOf() {
+    Archetype& a = archetype(componentMask<C...>(), nullptr, nullptr, 0);
+    int ids[] = { 0, (a.columns[componentId<C>()] ? 0 : (a.columns[componentId<C>()].reset(new Column<C>()), 0))... };
+    (void)ids;
+    return a;
+  }
+
+  uint32_t allocate() {
+    if (!freeIndices.empty()) {
+      uint32_t index = freeIndices.back();
+      freeIndices.pop_back();
+      return index;
+    }
+    records.emplace_back();
+    return uint32_t(records.size() - 1);
+  }
+
+  void removeRow(Archetype& a, size_t row) {
+    for (auto& c : a.columns)
+      if (c) c->swapRemove(row);
+    if (row + 1 != a.entities.size()) {
+      a.entities[row] = a.entities.back();
+      records[a.entities[row].index].row = row;
+    }
+    a.entities.pop_back();
+  }
+
+  template <typename... C, typename Fn, size_t... I>
+  static void eachRange(Archetype& a, size_t begin, size_t end, Fn& fn, std::index_sequence<I...>) {
+    std::tuple<C*...> cols(a.column<C>().data()...);
+    const EntityId* ids = a.entities.data();
+    for (size_t i = begin; i < end; i++) fn(ids[i], std::get<I>(cols)[i]...);
+  }
+
+public:
+  static const size_t chunkRows = 512; // rows per parallel work item
+
+  Registry() {}
+  Registry(const Registry&) = delete;
+  Registry& operator=(const Registry&) = delete;
+
+  EntityId create() {
+    uint32_t index = allocate();
+    EntityId e = { index, records[index].generation };
+    move(e, 0, nullptr, 0);
+    return e;
+  }
+
+  // Creates the entity straight in its final archetype, without the moves
+  // a create() followed by add()s would make.
+  template <typename C0, typename... C>
+  EntityId create(C0 first, C... rest) {
+    Archetype& a = archetypeOf<C0, C...>();
+    uint32_t index = allocate();
+    EntityId e = { index, records[index].generation };
+    a.column<C0>().push_back(std::move(first));
+    int ids[] = { 0, (a.column<C>().push_back(std::move(rest)), 0)... };
+    (void)ids;
+    a.entities.push_back(e);
+    records[index].archetype = &a;
+    records[index].row = a.size() - 1;
+    return e;
+  }
+
+  void destroy(EntityId e) {
+    if (!alive(e)) return;
+    Record& r = records[e.index];
+    removeRow(*r.archetype, r.row);
+    r.archetype = nullptr;
+    r.generation++;
+    freeIndices.push_back(e.index);
+  }
+
+  bool alive(EntityId e) const {
+    return e.index < records.size() && records[e.index].generation == e.generation &&
+      records[e.index].archetype != nullptr;
+  }
+
+  // The entity currently in slot index, for handles kept as a plain integer
+  // (a b2Body's userData, say).
+  EntityId at(uint32_t index) const {
+    EntityId e = { index, index < records.size() ? records[index].generation : 0 };
+    return e;
+  }
+
+  template <typename T>
+  T& add(EntityId e, T value = T()) {
+    Column<T> proto;
+    Record& r = records[e.index];
+    move(e, r.archetype->mask | ComponentMask(1) << componentId<T>(), &proto, componentId<T>());
+    T& slot = r.archetype->column<T>()[r.row];
+    slot = std::move(value);
+    return slot;
+  }
+
+  template <typename T>
+  void remove(EntityId e) {
+    Record& r = records[e.index];
+    move(e, r.archetype->mask & ~(ComponentMask(1) << componentId<T>()), nullptr, 0);
+  }
+
+  template <typename T>
+  bool has(EntityId e) const {
+    return alive(e) && (records[e.index].archetype->mask >> componentId<T>() & 1);
+  }
+
+  template <typename T>
+  T& get(EntityId e) {
+    Record& r = records[e.index];
+    return r.archetype->column<T>()[r.row];
+  }
+
+  // Pre-sizes the arrays of the archetype with exactly these components.
+  template <typename... C>
+  void reserve(size_t n) {
+    Archetype& a = archetypeOf<C...>();
+    a.entities.reserve(n);
+    for (auto& c : a.columns)
+      if (c) c->reserve(n);
+  }
+
+  template <typename... C>
+  size_t count() {
+    ComponentMask m = componentMask<C...>();
+    size_t n = 0;
+    for (auto a : archetypes)
+      if ((a->mask & m) == m) n += a->size();
+    return n;
+  }
+
+  // fn(EntityId, C&...) for every entity that has all of C, on this thread.
+  template <typename... C, typename Fn>
+  void each(Fn fn) {
+    ComponentMask m = componentMask<C...>();
+    for (size_t i = 0; i < archetypes.size(); i++) {
+      Archetype& a = *archetypes[i];
+      if ((a.mask & m) == m && a.size())
+        eachRange<C...>(a, 0, a.size(), fn, std::index_sequence_for<C...>());
+    }
+  }
+
+  // Like each(), with the rows split into chunks that run on the pool and the
+  // calling thread. fn runs concurrently for different entities.
+  template <typename... C, typename Fn>
+  void parallelEach(ThreadPool& pool, Fn fn) {
+    struct Range { Archetype* archetype; size_t begin, end; };
+    std::vector<Range> ranges;
+    ComponentMask m = componentMask<C...>();
+    for (auto a : archetypes) {
+      if ((a->mask & m) != m) continue;
+      for (size_t b = 0; b < a->size(); b += chunkRows)
+        ranges.push_back({ a, b, std::min(a->size(), b + chunkRows) });
+    }
+    if (ranges.size() == 1) {
+      eachRange<C...>(*ranges[0].archetype, ranges[0].begin, ranges[0].end, fn, std::index_sequence_for<C...>());
+      return;
+    }
+    pool.parallelFor(int(ranges.size()), [&](int i) {
+      eachRange<C...>(*ranges[i].archetype, ranges[i].begin, ranges[i].end, fn, std::index_sequence_for<C...>());
+    });
+  }
+
+  // Queues a structural change; safe to call from inside parallelEach.
+  void defer(std::function<void(Registry&)> command) {
+    std::lock_guard<std::mutex> lock(deferredMutex);
+    deferred.push_back(std::move(command));
+  }
+
+  void destroyLater(EntityId e) {
+    defer([e](Registry& r) { r.destroy(e); });
+  }
+
+  void flush() {
+    std::vector<std::function<void(Registry&)>> commands;
+    {
+      std::lock_guard<std::mutex> lock(deferredMutex);
+      commands.swap(deferred);
+    }
+    for (auto& c : commands) c(*this);
+  }
+};
+
+// Ordered list of systems. Each system declares the components it reads and
+// writes; consecutive systems that don't conflict run at the same time on the
+// pool. A system that declares nothing is exclusive: it runs alone on the
+// calling thread, which is what drawing and sound need. Deferred commands are
+// flushed after every group.
+//
+//   systems.add("ships", [&] { ... }).writes<Transform, Motion>().reads<Controls>();
+//   systems.add("draw", [&] { ... });  // exclusive
+//   systems.run();
+class Systems
+{
+public:
+  struct System {
+    const char* name; // string literal, also the profile zone name
+    std::function<void()> run;
+    ComponentMask readMask = 0, writeMask = 0;
+
+    template <typename... C> System& reads() { readMask |= componentMask<C...>(); return *this; }
+    template <typename... C> System& writes() { writeMask |= componentMask<C...>(); return *this; }
+    bool exclusive() const { return readMask == 0 && writeMask == 0; }
+  };
+
+private:
+  Registry& registry;
+  ThreadPool& pool;
+  std::vector<std::unique_ptr<System>> list;
+
+  static bool conflict(const System& a, const System& b) {
+    return (a.writeMask & (b.readMask | b.writeMask)) || (b.writeMask & a.readMask);
+  }
+
+  static void runOne(System& s) {
+    PROFILE_ZONE(s.name);
+    s.run();
+  }
+
+public:
+  Systems(Registry& r, ThreadPool& p) : registry(r), pool(p) {}
+
+  System& add(const char* name, std::function<void()> fn) {
+    list.emplace_back(new System());
+    list.back()->name = name;
+    list.back()->run = std::move(fn);
+    return *list.back();
+  }
+
+  void run() {
+    std::vector<System*> group;
+    size_t i = 0;
+    while (i < list.size()) {
+      group.clear();
+      group.push_back(list[i++].get());
+      if (!group[0]->exclusive()) {
+        while (i < list.size() && !list[i]->exclusive()) {
+          bool ok = true;
+          for (auto g : group) ok = ok && !conflict(*g, *list[i]);
+          if (!ok) break;
+          group.push_back(list[i++].get());
+        }
+      }
+      if (group.size() == 1) runOne(*group[0]);
+      else pool.parallelFor(int(group.size()), [&](int k) { runOne(*group[k]); });
+      registry.flush();
+    }
+  }
+};
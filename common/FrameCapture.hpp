@@ -0,0 +1,136 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "Profiler.hpp"
+#include "ThreadPool.hpp"
+
+// Records the game to a numbered PNG sequence, for trailers and for
+// reviewing regressions frame by frame.
+//
+//   FrameCapture capture;
+//   capture.create(1920, 1080, View(FloatRect(0, 0, W, H)));
+//   ...
+//   RenderTarget& target = capture.recording ? capture.begin() : window;
+//   // draw the frame into target
+//   if (capture.recording) capture.end(window);
+//
+// While recording, the frame is drawn into an offscreen texture of the
+// capture size, read back with copyToImage() and shown in the window as well.
+// Each frame stands for one fixed step of game time (step), however long it
+// took to produce. PNG encoding and the disk writes run on a pool of writer
+// threads. At most maxQueued frames wait for a writer; past that a frame is
+// dropped and counted, never waited for, so the game thread doesn't block on
+// I/O.
+class FrameCapture
+{
+  sf::RenderTexture target;
+  sf::Sprite sprite;
+  sf::View view;
+  ThreadPool writers;
+  std::atomic<int> pending{0};
+  std::string prefix;
+
+public:
+  bool recording = false;
+  sf::Time step = sf::seconds(1.0f / 60);
+  int maxQueued = 16; // 1080p RGBA is 8 MB a frame
+
+  int frame = 0;      // frames taken since start()
+  int dropped = 0;
+  std::atomic<int> written{0};
+  std::atomic<int> failed{0};
+
+  ~FrameCapture() { writers.wait(); }
+
+  bool create(unsigned width, unsigned height, const sf::View& gameView) {
+    if (!target.create(width, height)) return false;
+    view = gameView;
+    sprite.setTexture(target.getTexture(), true);
+    return true;
+  }
+
+  // Starts a new sequence in directory (created if missing).
+  void start(const std::string& directory) {
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+    prefix = directory + "/frame_";
+    frame = dropped = 0;
+    written = failed = 0;
+    recording = true;
+  }
+
+  void stop() {
+    recording = false;
+    printf("capture: %d frames, %d written, %d dropped, %d failed, %d still queued\n",
+      frame, written.load(), dropped, failed.load(), queued());
+  }
+
+  // Stops recording and waits for every queued frame to reach the disk.
+  void finish() {
+    if (recording) stop();
+    writers.wait();
+  }
+
+  int queued() const { return pending; }
+
+  sf::RenderTarget& begin() {
+    target.setView(view);
+    target.clear();
+    return target;
+  }
+
+  // Queues the frame drawn since begin() and copies it into the window,
+  // stretched over gameView. Call before window.display().
+  void end(sf::RenderWindow& window) {
+    PROFILE_ZONE("capture");
+    target.display();
+
+    int index = frame++;
+    if (pending >= maxQueued) {
+      dropped++;
+    } else {
+      auto image = std::make_shared<sf::Image>(target.getTexture().copyToImage());
+      char name[32];
+      snprintf(name, sizeof(name), "%06d.png", index);
+      std::string path = prefix + name;
+      pending++;
+      writers.push([this, image, path] {
+        PROFILE_ZONE("encode png");
+        if (image->saveToFile(path)) written++;
+        else failed++;
+        pending--;
+      });
+    }
+
+    // Keep the window's viewport, so a letterboxed window stays letterboxed.
+    sf::View windowView = view;
+    windowView.setViewport(window.getView().getViewport());
+    window.setView(windowView);
+    window.clear();
+    sprite.setScale(view.getSize().x / target.getSize().x, view.getSize().y / target.getSize().y);
+    sprite.setPosition(view.getCenter() - view.getSize() / 2.0f);
+    window.draw(sprite);
+  }
+
+  // One line for an on-screen indicator, e.g. "REC 000123  queued 2  dropped 0".
+  std::string status() const {
+    char s[96];
+    snprintf(s, sizeof(s), "REC %06d  queued %d  dropped %d", frame, queued(), dropped);
+    return s;
+  }
+};
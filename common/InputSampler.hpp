@@ -0,0 +1,219 @@
+#pragma once
+
+#include <SFML/System.hpp>
+#include <SFML/Window.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size FIFO that drops new items when full. Not synchronized; the
+// owner guards it. N must be a power of two.
+template <typename T, size_t N>
+class Ring
+{
+  static_assert((N & (N - 1)) == 0, "Ring size must be a power of two");
+
+  T items[N];
+  size_t head = 0; // next write
+  size_t tail = 0; // next read
+
+public:
+  bool push(const T& item) {
+    if (head - tail == N) return false;
+    items[head++ & (N - 1)] = item;
+    return true;
+  }
+
+  bool pop(T& item) {
+    if (tail == head) return false;
+    item = items[tail++ & (N - 1)];
+    return true;
+  }
+};
+
+struct InputEvent
+{
+  enum Type : uint8_t {
+    ButtonPressed, ButtonReleased, AxisMoved,
+    KeyPressed, KeyReleased,
+    Connected, Disconnected
+  };
+
+  Type type;
+  uint8_t joystick;  // joystick events
+  uint8_t button;    // ButtonPressed/Released
+  uint8_t axis;      // AxisMoved
+  float position;    // AxisMoved, -100..100
+  sf::Keyboard::Key key;
+  int64_t time;      // us on the InputSampler clock, when sampled or polled
+};
+
+// Queues every input change as a timestamped InputEvent. The simulation
+// drains the queue each tick, so a press and release that both happen
+// between two frames still arrive as two events.
+//
+// Joysticks are sampled at a fixed rate (1 kHz by default) on the sampler's
+// own thread. Keys come from the window's KeyPressed/KeyReleased events,
+// which the OS queues and never loses, so keyboard state is only ever read
+// on the window's thread (Keyboard::isKeyPressed isn't safe elsewhere on
+// X11).
+//
+// SFML keeps one joystick state for the process, and Window::pollEvent()
+// refreshes it too. The sampler's thread only touches it while holding
+// devices, so the window's thread polls through pollEvent() below, and
+// anything else that queries sf::Joystick (ImGui-SFML's Update, say) must
+// hold devices as well.
+class InputSampler
+{
+  typedef std::chrono::steady_clock clock;
+
+  static const int maxJoysticks = 4;
+  static const int maxButtons = 16;
+  static const int maxAxes = 2; // X and Y are all the games read
+
+  Ring<InputEvent, 4096> queue; // guarded by devices
+  std::thread thread;
+  std::atomic<bool> running{false};
+  clock::time_point epoch = clock::now();
+  std::vector<sf::Keyboard::Key> keys;
+
+  bool connected[maxJoysticks] = {};
+  bool buttons[maxJoysticks][maxButtons] = {};
+  float axes[maxJoysticks][maxAxes] = {};
+  std::vector<bool> keyDown;
+
+  std::atomic<bool> connectedFlags[maxJoysticks];
+
+  // With devices held.
+  void emit(InputEvent e) {
+    e.time = now();
+    if (!queue.push(e)) dropped++;
+  }
+
+  void sample() {
+    std::lock_guard<std::mutex> lock(devices);
+    sf::Joystick::update();
+    for (int j = 0; j < maxJoysticks; j++) {
+      bool c = sf::Joystick::isConnected(j);
+      if (c != connected[j]) {
+        connected[j] = c;
+        connectedFlags[j] = c;
+        InputEvent e = InputEvent();
+        e.type = c ? InputEvent::Connected : InputEvent::Disconnected;
+        e.joystick = uint8_t(j);
+        emit(e);
+      }
+      if (!c) continue;
+
+      for (int b = 0; b < maxButtons; b++) {
+        bool down = sf::Joystick::isButtonPressed(j, b);
+        if (down == buttons[j][b]) continue;
+        buttons[j][b] = down;
+        InputEvent e = InputEvent();
+        e.type = down ? InputEvent::ButtonPressed : InputEvent::ButtonReleased;
+        e.joystick = uint8_t(j);
+        e.button = uint8_t(b);
+        emit(e);
+      }
+      for (int a = 0; a < maxAxes; a++) {
+        float p = sf::Joystick::getAxisPosition(j, sf::Joystick::Axis(a));
+        if (std::abs(p - axes[j][a]) < axisDeadband) continue;
+        axes[j][a] = p;
+        InputEvent e = InputEvent();
+        e.type = InputEvent::AxisMoved;
+        e.joystick = uint8_t(j);
+        e.axis = uint8_t(a);
+        e.position = p;
+        emit(e);
+      }
+    }
+  }
+
+  void run(int hz) {
+    auto period = std::chrono::microseconds(1000000 / hz);
+    auto next = clock::now();
+    while (running) {
+      sample();
+      next += period;
+      // sf::sleep raises the Windows timer resolution to 1 ms while it waits.
+      auto wait = std::chrono::duration_cast<std::chrono::microseconds>(next - clock::now());
+      if (wait.count() > 0) sf::sleep(sf::microseconds(wait.count()));
+      else next = clock::now();
+    }
+  }
+
+public:
+  std::mutex devices; // SFML's joystick state and the queue
+  float axisDeadband = 1.0f;
+  uint64_t dropped = 0; // events lost to a full queue, guarded by devices
+
+  // Latency from sampling to the consumer picking the event up, in us.
+  int64_t latencyMax = 0;
+  double latencyAvg = 0;
+
+  // watchedKeys are the keys whose window events are also queued.
+  explicit InputSampler(std::vector<sf::Keyboard::Key> watchedKeys = std::vector<sf::Keyboard::Key>())
+    : keys(watchedKeys), keyDown(watchedKeys.size(), false) {
+    for (auto& c : connectedFlags) c = false;
+  }
+
+  ~InputSampler() { stop(); }
+
+  InputSampler(const InputSampler&) = delete;
+  InputSampler& operator=(const InputSampler&) = delete;
+
+  void start(int hz = 1000) {
+    if (running) return;
+    running = true;
+    thread = std::thread([this, hz] { run(hz); });
+  }
+
+  void stop() {
+    running = false;
+    if (thread.joinable()) thread.join();
+  }
+
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - epoch).count();
+  }
+
+  bool isConnected(unsigned joystick) const {
+    return joystick < maxJoysticks && connectedFlags[joystick];
+  }
+
+  // Window thread, in place of window.pollEvent(e): polls with devices held
+  // and queues the watched keys' presses and releases (key repeats are
+  // dropped). The event is still returned to the caller.
+  bool pollEvent(sf::Window& window, sf::Event& e) {
+    std::lock_guard<std::mutex> lock(devices);
+    if (!window.pollEvent(e)) return false;
+    if (e.type != sf::Event::KeyPressed && e.type != sf::Event::KeyReleased) return true;
+    size_t k = std::find(keys.begin(), keys.end(), e.key.code) - keys.begin();
+    bool down = e.type == sf::Event::KeyPressed;
+    if (k == keys.size() || keyDown[k] == down) return true;
+    keyDown[k] = down;
+    InputEvent ie = InputEvent();
+    ie.type = down ? InputEvent::KeyPressed : InputEvent::KeyReleased;
+    ie.key = keys[k];
+    emit(ie);
+    return true;
+  }
+
+  // Consumer side, called from the simulation tick until it returns false.
+  bool poll(InputEvent& e) {
+    {
+      std::lock_guard<std::mutex> lock(devices);
+      if (!queue.pop(e)) return false;
+    }
+    int64_t latency = now() - e.time;
+    latencyMax = std::max(latencyMax, latency);
+    latencyAvg += (latency - latencyAvg) * 0.05;
+    return true;
+  }
+};
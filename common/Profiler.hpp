@@ -0,0 +1,319 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped-timer instrumentation shared by the games.
+//
+//   PROFILE_ZONE("update");        // times the rest of the enclosing scope
+//   Profiler::get().frameMark();   // once per frame, after display()
+//
+// Each thread records into its own ring buffer, so zones never take a lock.
+// While the profiler is disabled a zone costs one relaxed atomic load; build
+// with PROFILER_DISABLED to compile the zones out completely. Zone names must
+// be string literals (only the pointer is stored).
+
+struct ProfileEvent
+{
+  const char* name;
+  int64_t start, end; // ns since Profiler creation
+  int depth;
+};
+
+// Single-writer ring of events. Each slot carries a sequence number that is
+// odd while the owner is writing it and 2 * (event index + 1) once the event
+// is complete, so a reader can copy a slot seqlock-style and tell whether the
+// owner touched it in the meantime.
+class ProfileBuffer
+{
+public:
+  static const int capacity = 8192;
+
+  struct Slot
+  {
+    std::atomic<uint32_t> seq{0};
+    ProfileEvent event;
+  };
+
+  int id;
+  std::string threadName;
+  Slot slots[capacity];
+  std::atomic<uint32_t> head{0}; // total events ever written
+  int depth = 0;
+
+  void push(const ProfileEvent& e) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    Slot& s = slots[h % capacity];
+    s.seq.store(2 * h + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.event = e;
+    s.seq.store(2 * h + 2, std::memory_order_release);
+    head.store(h + 1, std::memory_order_release);
+  }
+
+  // Copies event number i into out. Fails if that event was never completed,
+  // has already been overwritten, or was being overwritten during the copy.
+  bool read(uint32_t i, ProfileEvent& out) const {
+    const Slot& s = slots[i % capacity];
+    uint32_t before = s.seq.load(std::memory_order_acquire);
+    if (before != 2 * i + 2) return false;
+    out = s.event;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return s.seq.load(std::memory_order_relaxed) == before;
+  }
+};
+
+class Profiler
+{
+  typedef std::chrono::steady_clock clock;
+
+  clock::time_point epoch = clock::now();
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ProfileBuffer>> buffers;
+  int64_t frameStart = 0, frameEnd = 0, lastMark = 0;
+
+  Profiler() {}
+
+public:
+  std::atomic<bool> enabled{false};
+
+  static Profiler& get() {
+    static Profiler instance;
+    return instance;
+  }
+
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - epoch).count();
+  }
+
+  // Buffers live as long as the profiler, so a trace still shows the work of
+  // threads that have already exited.
+  ProfileBuffer& threadBuffer() {
+    static thread_local ProfileBuffer* buffer = nullptr;
+    if (!buffer) {
+      std::lock_guard<std::mutex> lock(mutex);
+      buffers.emplace_back(new ProfileBuffer());
+      buffer = buffers.back().get();
+      buffer->id = int(buffers.size());
+      buffer->threadName = "thread " + std::to_string(buffer->id);
+    }
+    return *buffer;
+  }
+
+  void setThreadName(const std::string& name) {
+    ProfileBuffer& b = threadBuffer();
+    std::lock_guard<std::mutex> lock(mutex);
+    b.threadName = name;
+  }
+
+  // Closes the current frame; the overlay shows the last closed frame.
+  void frameMark() {
+    int64_t t = now();
+    frameStart = lastMark;
+    frameEnd = t;
+    lastMark = t;
+  }
+
+  int64_t lastFrameStart() const { return frameStart; }
+  int64_t lastFrameEnd() const { return frameEnd; }
+
+  // Copies the recorded events of every thread that overlap [from, to).
+  // Safe to call while other threads keep recording: every returned event is
+  // one its owner had completed, copied intact. Events the owner overwrites
+  // while they are being read are dropped rather than returned torn.
+  void collect(int64_t from, int64_t to, std::vector<ProfileEvent>& out, std::vector<int>& threads) {
+    out.clear();
+    threads.clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& b : buffers) {
+      uint32_t h = b->head.load(std::memory_order_acquire);
+      uint32_t count = std::min<uint32_t>(h, ProfileBuffer::capacity);
+      ProfileEvent e;
+      for (uint32_t i = h - count; i != h; i++) {
+        if (!b->read(i, e)) continue;
+        if (e.end >= from && e.start < to) {
+          out.push_back(e);
+          threads.push_back(b->id);
+        }
+      }
+    }
+  }
+
+  // Writes everything still in the ring buffers as Chrome trace_event JSON,
+  // loadable in chrome://tracing or ui.perfetto.dev.
+  bool exportChromeTrace(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+
+    std::vector<ProfileEvent> events;
+    std::vector<int> threads;
+    collect(0, now() + 1, events, threads);
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto& b : buffers) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+          first ? "" : ",\n", b->id, b->threadName.c_str());
+        first = false;
+      }
+    }
+    for (size_t i = 0; i < events.size(); i++) {
+      const ProfileEvent& e = events[i];
+      fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+        first ? "" : ",\n", e.name, threads[i], e.start / 1000.0, (e.end - e.start) / 1000.0);
+      first = false;
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(f);
+    return true;
+  }
+};
+
+class ProfileZone
+{
+  const char* name = nullptr;
+  int64_t start;
+
+public:
+  explicit ProfileZone(const char* zoneName) {
+    Profiler& p = Profiler::get();
+    if (!p.enabled.load(std::memory_order_relaxed)) return;
+    name = zoneName;
+    p.threadBuffer().depth++;
+    start = p.now();
+  }
+
+  ~ProfileZone() {
+    if (!name) return;
+    Profiler& p = Profiler::get();
+    ProfileBuffer& b = p.threadBuffer();
+    b.depth--;
+    b.push({ name, start, p.now(), b.depth });
+  }
+
+  ProfileZone(const ProfileZone&) = delete;
+  ProfileZone& operator=(const ProfileZone&) = delete;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#ifdef PROFILER_DISABLED
+#define PROFILE_ZONE(name) ((void)0)
+#else
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#endif
+
+// Flame graph of the last closed frame: one row group per thread, nested
+// zones stacked below their parent, all bars batched into one vertex array.
+class ProfilerOverlay
+{
+  std::vector<ProfileEvent> events;
+  std::vector<int> threads;
+  sf::VertexArray bars{sf::Quads};
+  sf::Text label;
+  sf::RectangleShape panel;
+  sf::RectangleShape budgetLine;
+
+  static sf::Color colorOf(const char* name) {
+    unsigned h = 2166136261u;
+    for (const char* c = name; *c; c++) h = (h ^ (unsigned char)*c) * 16777619u;
+    return sf::Color(80 + h % 150, 80 + (h >> 8) % 150, 80 + (h >> 16) % 150);
+  }
+
+  void addBar(float x, float y, float w, float h, sf::Color c) {
+    bars.append(sf::Vertex(sf::Vector2f(x, y), c));
+    bars.append(sf::Vertex(sf::Vector2f(x + w, y), c));
+    bars.append(sf::Vertex(sf::Vector2f(x + w, y + h), c));
+    bars.append(sf::Vertex(sf::Vector2f(x, y + h), c));
+  }
+
+public:
+  bool visible = false;
+  float budgetMs = 1000.0f / 60;
+  float rowHeight = 18;
+
+  explicit ProfilerOverlay(const sf::Font& font) {
+    label.setFont(font);
+    label.setCharacterSize(14);
+    label.setFillColor(sf::Color::White);
+    panel.setFillColor(sf::Color(0, 0, 0, 180));
+    budgetLine.setFillColor(sf::Color::Red);
+  }
+
+  // Draws at (x, y) in the target's current view; the width spans twice the
+  // frame budget so overruns are easy to spot.
+  void draw(sf::RenderTarget& target, float x, float y, float width) {
+    if (!visible) return;
+    Profiler& p = Profiler::get();
+    int64_t from = p.lastFrameStart(), to = p.lastFrameEnd();
+    p.collect(from, to, events, threads);
+
+    float span = budgetMs * 2 * 1e6f;
+    float pxPerNs = width / span;
+
+    // Thread rows in first-seen order, each as deep as its deepest zone.
+    std::vector<int> order, depth;
+    for (size_t i = 0; i < events.size(); i++) {
+      size_t r = std::find(order.begin(), order.end(), threads[i]) - order.begin();
+      if (r == order.size()) { order.push_back(threads[i]); depth.push_back(0); }
+      depth[r] = std::max(depth[r], events[i].depth + 1);
+    }
+    std::vector<float> rowY(order.size());
+    float height = 0;
+    for (size_t r = 0; r < order.size(); r++) {
+      rowY[r] = y + height;
+      height += depth[r] * rowHeight + 4;
+    }
+
+    panel.setPosition(x, y);
+    panel.setSize(sf::Vector2f(width, std::max(height, rowHeight) + 20));
+    target.draw(panel);
+
+    bars.clear();
+    for (size_t i = 0; i < events.size(); i++) {
+      const ProfileEvent& e = events[i];
+      size_t r = std::find(order.begin(), order.end(), threads[i]) - order.begin();
+      float bx = x + std::max<int64_t>(e.start - from, 0) * pxPerNs;
+      float bw = std::max(1.0f, (std::min(e.end, to) - std::max(e.start, from)) * pxPerNs);
+      if (bx > x + width) continue;
+      bw = std::min(bw, x + width - bx);
+      addBar(bx, rowY[r] + e.depth * rowHeight, bw, rowHeight - 1, colorOf(e.name));
+    }
+    target.draw(bars);
+
+    budgetLine.setPosition(x + width / 2, y);
+    budgetLine.setSize(sf::Vector2f(1, panel.getSize().y));
+    target.draw(budgetLine);
+
+    // Label the zones wide enough to read.
+    for (size_t i = 0; i < events.size(); i++) {
+      const ProfileEvent& e = events[i];
+      float ms = (e.end - e.start) / 1e6f;
+      float bw = (e.end - e.start) * pxPerNs;
+      if (bw < 60) continue;
+      size_t r = std::find(order.begin(), order.end(), threads[i]) - order.begin();
+      char text[64];
+      snprintf(text, sizeof(text), "%s %.2f", e.name, ms);
+      label.setString(text);
+      label.setPosition(x + std::max<int64_t>(e.start - from, 0) * pxPerNs + 2, rowY[r] + e.depth * rowHeight);
+      target.draw(label);
+    }
+
+    char text[64];
+    snprintf(text, sizeof(text), "frame %.2f ms", (to - from) / 1e6f);
+    label.setString(text);
+    label.setPosition(x + 2, y + panel.getSize().y - 18);
+    target.draw(label);
+  }
+};
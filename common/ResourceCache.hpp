@@ -0,0 +1,159 @@
+#pragma once
+
+#include <SFML/Audio.hpp>
+#include <SFML/Graphics.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "AssetPack.hpp"
+
+// Assets shared by path: every acquire() of the same path returns the same
+// reference-counted instance, and the asset is freed when the last
+// shared_ptr to it goes away.
+//
+//   auto font = Resources::get().fonts.acquire("fonts/sansation.ttf");
+//   Lazy<sf::Texture> big = Resources::get().textures.lazy("images/big.png");
+//
+// Memory figures are estimates of what the asset keeps resident: decoded
+// pixels for textures and images, samples for sound buffers and the file
+// size for fonts (glyph pages grow on demand and aren't counted).
+
+inline size_t fileSize(const std::string& path)
+{
+  if (const PackEntry* e = AssetPack::mounted().find(path)) return size_t(e->rawSize);
+  std::ifstream f(path, std::ios::binary | std::ios::ate);
+  return f ? size_t(f.tellg()) : 0;
+}
+
+// Reads from the mounted asset pack when it has the path, else the loose file.
+inline bool loadResource(sf::Texture& t, const std::string& path) { return loadFromPack(t, path); }
+inline bool loadResource(sf::Image& i, const std::string& path) { return loadFromPack(i, path); }
+inline bool loadResource(sf::SoundBuffer& b, const std::string& path) { return loadFromPack(b, path); }
+inline bool loadResource(sf::Font& f, const std::string& path) { return loadFromPack(f, path); }
+
+inline size_t resourceBytes(const sf::Texture& t, const std::string&) { return size_t(t.getSize().x) * t.getSize().y * 4; }
+inline size_t resourceBytes(const sf::Image& i, const std::string&) { return size_t(i.getSize().x) * i.getSize().y * 4; }
+inline size_t resourceBytes(const sf::SoundBuffer& b, const std::string&) { return size_t(b.getSampleCount()) * sizeof(sf::Int16); }
+inline size_t resourceBytes(const sf::Font&, const std::string& path) { return fileSize(path); }
+
+template <typename T> class ResourceCache;
+
+// Handle that loads its asset on first use instead of up front.
+template <typename T>
+class Lazy
+{
+  ResourceCache<T>* cache = nullptr;
+  std::string path;
+  std::shared_ptr<T> resource;
+
+public:
+  Lazy() {}
+  Lazy(ResourceCache<T>& c, const std::string& p) : cache(&c), path(p) {}
+
+  bool loaded() const { return resource != nullptr; }
+  std::shared_ptr<T> shared() {
+    if (!resource && cache) resource = cache->acquire(path);
+    return resource;
+  }
+  T& get() { return *shared(); }
+};
+
+template <typename T>
+class ResourceCache
+{
+  struct Entry {
+    std::weak_ptr<T> resource;
+    size_t bytes;
+    int acquired; // acquire() calls served by this instance
+  };
+  std::map<std::string, Entry> entries;
+
+public:
+  const char* typeName;
+  int requests = 0;
+  int hits = 0;
+  // What each acquire() after the first of a resident instance would have
+  // cost as a private copy. The first acquire of an inserted asset is its
+  // only user so far, so it doesn't count.
+  size_t savedBytes = 0;
+
+  explicit ResourceCache(const char* name) : typeName(name) {}
+
+  // Eager policy: returns the resident instance or loads it now. Returns
+  // null, and prints the path, if the file can't be loaded.
+  std::shared_ptr<T> acquire(const std::string& path) {
+    requests++;
+    Entry& e = entries[path];
+    if (auto r = e.resource.lock()) {
+      hits++;
+      if (++e.acquired > 1) savedBytes += e.bytes;
+      return r;
+    }
+    std::shared_ptr<T> r = std::make_shared<T>();
+    if (!loadResource(*r, path)) {
+      printf("failed to load %s\n", path.c_str());
+      entries.erase(path);
+      return nullptr;
+    }
+    e.resource = r;
+    e.bytes = resourceBytes(*r, path);
+    e.acquired = 1;
+    return r;
+  }
+
+  // Adopts an asset loaded elsewhere (e.g. decoded on a worker thread).
+  std::shared_ptr<T> insert(const std::string& path, std::shared_ptr<T> r) {
+    Entry& e = entries[path];
+    e.resource = r;
+    e.bytes = resourceBytes(*r, path);
+    e.acquired = 0;
+    return r;
+  }
+
+  // Lazy policy: nothing is read until the handle is first used.
+  Lazy<T> lazy(const std::string& path) { return Lazy<T>(*this, path); }
+
+  int residentCount() const {
+    int n = 0;
+    for (auto& kv : entries) if (!kv.second.resource.expired()) n++;
+    return n;
+  }
+
+  size_t residentBytes() const {
+    size_t n = 0;
+    for (auto& kv : entries) if (!kv.second.resource.expired()) n += kv.second.bytes;
+    return n;
+  }
+
+  void report() const {
+    printf("%-13s %3d resident %8.2f MB | %3d requests %3d hits, saved %.2f MB\n",
+      typeName, residentCount(), residentBytes() / 1048576.0, requests, hits, savedBytes / 1048576.0);
+  }
+};
+
+class Resources
+{
+  Resources() {}
+
+public:
+  ResourceCache<sf::Texture> textures{"textures"};
+  ResourceCache<sf::Image> images{"images"};
+  ResourceCache<sf::SoundBuffer> sounds{"sound buffers"};
+  ResourceCache<sf::Font> fonts{"fonts"};
+
+  static Resources& get() {
+    static Resources instance;
+    return instance;
+  }
+
+  void report() const {
+    textures.report();
+    images.report();
+    sounds.report();
+    fonts.report();
+  }
+};
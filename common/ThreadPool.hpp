@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads fed from a single task queue. Header only, so
+// each game keeps building from its one main.cpp.
+class ThreadPool
+{
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  int busy = 0;
+  bool stopping = false;
+
+  void run() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (stopping && tasks.empty()) return;
+        task = std::move(tasks.front());
+        tasks.pop();
+        busy++;
+      }
+      task();
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        busy--;
+        if (busy == 0 && tasks.empty()) idle.notify_all();
+      }
+    }
+  }
+
+public:
+  // count == 0 picks one worker per hardware thread, minus the caller's.
+  explicit ThreadPool(unsigned count = 0) {
+    if (count == 0) {
+      unsigned hw = std::thread::hardware_concurrency();
+      count = hw > 1 ? hw - 1 : 1;
+    }
+    for (unsigned i = 0; i < count; i++)
+      workers.emplace_back([this] { run(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers) t.join();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  unsigned size() const { return (unsigned)workers.size(); }
+
+  void push(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push(std::move(task));
+    }
+    wake.notify_one();
+  }
+
+  // Blocks until every pushed task has finished.
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return busy == 0 && tasks.empty(); });
+  }
+
+  // Calls fn(i) for every i in [0, count), spread over the workers and the
+  // calling thread, and returns once all calls are done.
+  void parallelFor(int count, const std::function<void(int)>& fn) {
+    if (count <= 0) return;
+
+    struct Batch {
+      std::atomic<int> next{0};
+      std::atomic<int> done{0};
+      std::mutex mutex;
+      std::condition_variable finished;
+    };
+    auto batch = std::make_shared<Batch>();
+
+    auto drain = [batch, count, &fn] {
+      int n = 0;
+      for (int i = batch->next++; i < count; i = batch->next++) {
+        fn(i);
+        n++;
+      }
+      if (n > 0 && (batch->done += n) == count) {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        batch->finished.notify_all();
+      }
+    };
+
+    int helpers = std::min<int>(size(), count - 1);
+    for (int i = 0; i < helpers; i++) push(drain);
+    drain();
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->finished.wait(lock, [&] { return batch->done == count; });
+  }
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free single-writer/single-reader handoff of whole frames. The writer
+// fills writeBuffer() and publish()es it; the reader calls update() and then
+// uses readBuffer(), which always holds the newest complete frame. Neither
+// side ever waits, and a frame is never modified while it is being read.
+template <typename T>
+class TripleBuffer
+{
+  static const int fresh = 4; // flag on middle: published since the last update()
+
+  T slots[3];
+  std::atomic<int> middle{1};
+  int back = 0;  // writer's
+  int front = 2; // reader's
+
+public:
+  T& writeBuffer() { return slots[back]; }
+
+  void publish() {
+    back = middle.exchange(back | fresh, std::memory_order_acq_rel) & 3;
+  }
+
+  // Swaps in the newest frame if there is one. Returns false otherwise.
+  bool update() {
+    if (!(middle.load(std::memory_order_acquire) & fresh)) return false;
+    front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+    return true;
+  }
+
+  const T& readBuffer() const { return slots[front]; }
+};
@@ -0,0 +1 @@
+cl.exe /EHsc /I"..\..\00 box2d" levelc.cpp /link /out:levelc.exe
\ No newline at end of file
@@ -0,0 +1,55 @@
+// Compiles a text level (see "00 box2d/Level.hpp") into the binary form the
+// Box2D demo maps at startup and reloads whenever the file changes.
+//
+//   levelc <level.txt> <level.lvl>
+//
+// The output is written to a temporary file and renamed over the old one,
+// so a running game never sees half a level.
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Level.hpp"
+
+int main(int argc, char** argv)
+{
+  if (argc != 3) {
+    printf("usage: levelc <level.txt> <level.lvl>\n");
+    return 1;
+  }
+
+  std::ifstream in(argv[1]);
+  if (!in) {
+    printf("levelc: can't read %s\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<uint8_t> bytes;
+  std::string error;
+  if (!compileLevel(in, bytes, error)) {
+    printf("levelc: %s: %s\n", argv[1], error.c_str());
+    return 1;
+  }
+
+  std::string outPath = argv[2];
+  std::string tmpPath = outPath + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary);
+    out.write((const char*)bytes.data(), std::streamsize(bytes.size()));
+    if (!out) {
+      printf("levelc: can't write %s\n", tmpPath.c_str());
+      return 1;
+    }
+  }
+  std::remove(outPath.c_str()); // rename doesn't replace on Windows
+  if (std::rename(tmpPath.c_str(), outPath.c_str()) != 0) {
+    printf("levelc: can't replace %s\n", outPath.c_str());
+    return 1;
+  }
+
+  const LevelHeader* h = (const LevelHeader*)bytes.data();
+  printf("%s: %u bodies, %zu bytes\n", outPath.c_str(), h->bodyCount, bytes.size());
+  return 0;
+}
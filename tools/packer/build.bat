@@ -0,0 +1 @@
+cl.exe /EHsc /std:c++17 /I..\..\sfml\include /I..\..\common packer.cpp /link /libpath:..\..\sfml\lib sfml-system.lib sfml-graphics.lib /out:packer.exe
\ No newline at end of file
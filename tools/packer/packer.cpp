@@ -0,0 +1,219 @@
+// Builds an asset pack (see common/AssetPack.hpp) from loose files.
+//
+//   packer <out.pak> [-c] [--raw <image>]... <file or directory>...
+//
+// Run it from the game's folder so the stored paths match the ones the game
+// loads, e.g. "images/blueship.png". -c LZ4-compresses every entry that gets
+// smaller (fonts and music are stored as is: SFML reads them in place).
+// --raw stores an image pre-decoded as RGBA so the game can upload it without
+// decoding.
+
+#include <SFML/Graphics.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "AssetPack.hpp"
+
+namespace fs = std::filesystem;
+
+static uint32_t read32(const uint8_t* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+}
+
+static void putLength(std::vector<uint8_t>& out, size_t n)
+{
+  while (n >= 255) { out.push_back(255); n -= 255; }
+  out.push_back(uint8_t(n));
+}
+
+// Greedy LZ4 block compressor with a single-entry hash table. Keeps the
+// format's end-of-block rules: the last 5 bytes are literals and the last
+// match starts at least 12 bytes before the end.
+static std::vector<uint8_t> lz4Compress(const uint8_t* src, size_t n)
+{
+  const int hashBits = 16;
+  std::vector<uint8_t> out;
+  out.reserve(n + n / 255 + 16);
+  std::vector<int64_t> table(size_t(1) << hashBits, -1);
+
+  size_t anchor = 0, i = 0;
+  const size_t matchStartLimit = n > 12 ? n - 12 : 0;
+  const size_t matchEndLimit = n > 5 ? n - 5 : 0;
+
+  while (i < matchStartLimit) {
+    uint32_t seq = read32(src + i);
+    uint32_t h = (seq * 2654435761u) >> (32 - hashBits);
+    int64_t ref = table[h];
+    table[h] = int64_t(i);
+
+    if (ref < 0 || i - size_t(ref) > 65535 || read32(src + ref) != seq) {
+      i++;
+      continue;
+    }
+
+    size_t length = 4;
+    while (i + length < matchEndLimit && src[ref + length] == src[i + length]) length++;
+
+    size_t literals = i - anchor;
+    size_t offset = i - size_t(ref);
+    out.push_back(uint8_t((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(length - 4, 15)));
+    if (literals >= 15) putLength(out, literals - 15);
+    out.insert(out.end(), src + anchor, src + i);
+    out.push_back(uint8_t(offset & 0xff));
+    out.push_back(uint8_t(offset >> 8));
+    if (length - 4 >= 15) putLength(out, length - 4 - 15);
+
+    i += length;
+    anchor = i;
+  }
+
+  size_t literals = n - anchor;
+  out.push_back(uint8_t(std::min<size_t>(literals, 15) << 4));
+  if (literals >= 15) putLength(out, literals - 15);
+  out.insert(out.end(), src + anchor, src + n);
+  return out;
+}
+
+struct Input
+{
+  std::string path;
+  std::vector<uint8_t> data;
+  PackEntry entry;
+};
+
+static bool readFile(const std::string& path, std::vector<uint8_t>& data)
+{
+  std::ifstream f(path, std::ios::binary);
+  if (!f) return false;
+  data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  return true;
+}
+
+static bool streamedInPlace(const std::string& path)
+{
+  std::string ext = fs::path(path).extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  return ext == ".ttf" || ext == ".otf" || ext == ".ogg" || ext == ".flac";
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 3) {
+    printf("usage: packer <out.pak> [-c] [--raw <image>]... <file or directory>...\n");
+    return 1;
+  }
+
+  std::string outPath = argv[1];
+  bool compress = false;
+  std::vector<std::string> raw, roots;
+  for (int i = 2; i < argc; i++) {
+    std::string a = argv[i];
+    if (a == "-c") compress = true;
+    else if (a == "--raw" && i + 1 < argc) raw.push_back(argv[++i]);
+    else roots.push_back(a);
+  }
+
+  std::vector<std::string> paths;
+  for (auto& r : roots) {
+    if (fs::is_directory(r)) {
+      for (auto& f : fs::recursive_directory_iterator(r))
+        if (f.is_regular_file()) paths.push_back(f.path().generic_string());
+    } else {
+      paths.push_back(fs::path(r).generic_string());
+    }
+  }
+  for (auto& r : raw) {
+    std::string p = fs::path(r).generic_string();
+    if (std::find(paths.begin(), paths.end(), p) == paths.end()) paths.push_back(p);
+  }
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+  std::vector<Input> inputs;
+  for (auto& p : paths) {
+    Input in;
+    in.path = p;
+    in.entry = PackEntry();
+    if (p.size() >= sizeof(in.entry.path)) {
+      printf("path too long for the index: %s\n", p.c_str());
+      return 1;
+    }
+    memcpy(in.entry.path, p.c_str(), p.size());
+
+    if (std::find(raw.begin(), raw.end(), p) != raw.end()) {
+      sf::Image image;
+      if (!image.loadFromFile(p)) return 1;
+      const uint8_t* pixels = image.getPixelsPtr();
+      in.data.assign(pixels, pixels + size_t(image.getSize().x) * image.getSize().y * 4);
+      in.entry.flags |= PackRGBA;
+      in.entry.width = image.getSize().x;
+      in.entry.height = image.getSize().y;
+    } else if (!readFile(p, in.data)) {
+      printf("can't read %s\n", p.c_str());
+      return 1;
+    }
+    in.entry.rawSize = in.data.size();
+
+    if (compress && !streamedInPlace(p) && !in.data.empty()) {
+      std::vector<uint8_t> packed = lz4Compress(in.data.data(), in.data.size());
+      std::vector<uint8_t> check(in.data.size());
+      if (!lz4Decompress(packed.data(), packed.size(), check.data(), check.size()) || check != in.data) {
+        printf("LZ4 round trip failed for %s\n", p.c_str());
+        return 1;
+      }
+      if (packed.size() < in.data.size()) {
+        in.data.swap(packed);
+        in.entry.flags |= PackCompressed;
+      }
+    }
+    in.entry.size = in.data.size();
+    inputs.push_back(std::move(in));
+  }
+
+  // Header and index first, so a loader touches the file front to back.
+  auto align = [](uint64_t n) { return (n + packAlignment - 1) / packAlignment * packAlignment; };
+  uint64_t offset = align(sizeof(PackHeader) + inputs.size() * sizeof(PackEntry));
+
+  PackHeader header = PackHeader();
+  memcpy(header.magic, packMagic, sizeof(header.magic));
+  header.version = 1;
+  header.entryCount = uint32_t(inputs.size());
+  header.dataOffset = offset;
+
+  for (auto& in : inputs) {
+    in.entry.offset = offset;
+    offset = align(offset + in.entry.size);
+  }
+
+  std::ofstream out(outPath, std::ios::binary);
+  if (!out) {
+    printf("can't write %s\n", outPath.c_str());
+    return 1;
+  }
+  out.write((const char*)&header, sizeof(header));
+  for (auto& in : inputs) out.write((const char*)&in.entry, sizeof(in.entry));
+
+  uint64_t rawTotal = 0, storedTotal = 0;
+  for (auto& in : inputs) {
+    std::vector<char> pad(size_t(in.entry.offset - uint64_t(out.tellp())), 0);
+    out.write(pad.data(), pad.size());
+    out.write((const char*)in.data.data(), in.data.size());
+    rawTotal += in.entry.rawSize;
+    storedTotal += in.entry.size;
+    printf("%-40s %10llu -> %10llu%s%s\n", in.path.c_str(), (unsigned long long)in.entry.rawSize,
+      (unsigned long long)in.entry.size, in.entry.flags & PackRGBA ? " rgba" : "",
+      in.entry.flags & PackCompressed ? " lz4" : "");
+  }
+  std::vector<char> pad(size_t(offset - uint64_t(out.tellp())), 0);
+  out.write(pad.data(), pad.size());
+
+  printf("%zu entries, %llu -> %llu bytes, %s\n", inputs.size(), (unsigned long long)rawTotal,
+    (unsigned long long)storedTotal, outPath.c_str());
+  return out ? 0 : 1;
+}